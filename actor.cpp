@@ -1,103 +1,5 @@
 #include "precomp.h"
 
-// Tank constructor
-Tank::Tank( Sprite* s, int2 p, int2 t, int f, int a )
-{
-	// set position and destination
-	pos = make_float2( p );
-	target = make_float2( t );
-	// create sprite instance based on existing sprite
-	sprite = SpriteInstance( s );
-	// set intial orientation / sprite frame; 0: north; 64: east; 128: south; 192: east
-	frame = f;
-	// assign tank to the specified army
-	army = a;
-	// create the static array of directions if it doesn't exist yet
-	if (directions == 0)
-	{
-		directions = new float2[256];
-		for (int i = 0; i < 256; i++) directions[i] = make_float2( sinf( i * PI / 128 ), -cosf( i * PI / 128 ) );
-	}
-	// set direction based on specified orientation
-	dir = directions[frame];
-}
-
-// Tank::Tick : tank behaviour
-bool Tank::Tick()
-{
-	// handle incoming bullets
-	if (hitByBullet)
-	{
-		MyApp::actorPool.push_back( new ParticleExplosion( this ) );
-		return false;
-	}
-	// fire bullet if cooled down and enemy is in range
-	if (coolDown > 200 && MyApp::coolDown > 4)
-	{
-		// query a grid to rapidly obtain a list of nearby tanks
-		ActorList& nearby = MyApp::grid.FindNearbyTanks( pos + dir * 200 );
-		for (int i = 0; i < nearby.count; i++) if (nearby.tank[i]->army != this->army)
-		{
-			float2 toActor = normalize( nearby.tank[i]->pos - this->pos );
-			if (dot( toActor, dir ) > 0.8f /* within view cone*/)
-			{
-				// create a bullet and add it to the actor list
-				Bullet* newBullet = new Bullet( make_int2( pos + 20 * dir ), frame, army );
-				MyApp::actorPool.push_back( newBullet );
-				// reset cooldown timer so we don't do rapid fire
-				coolDown = 0;
-				MyApp::coolDown = 0;
-				break;
-			}
-		}
-	}
-	coolDown++;
-	// accumulate forces for steering left or right
-	// 1. target attracts
-	float2 toTarget = normalize( target - pos );
-	float2 toRight = make_float2( -dir.y, dir.x );
-	float steer = 2 * dot( toRight, toTarget );
-	// 2. mountains repel
-	float2 probePos = pos + 8 * dir;
-	for (int s = (int)MyApp::peaks.size(), i = 0; i < s; i++)
-	{
-		float peakMag = MyApp::peaks[i].z / 2;
-		float2 toPeak = make_float2( MyApp::peaks[i].x, MyApp::peaks[i].y ) - probePos;
-		float sqrDist = dot( toPeak, toPeak );
-		if (sqrDist < sqrf( peakMag ))
-			toPeak = normalize( toPeak ),
-			steer -= dot( toRight, toPeak ) * peakMag / sqrtf( sqrDist );
-	}
-	// 3. evade other tanks
-	ActorList& nearby = MyApp::grid.FindNearbyTanks( this );
-	for (int i = 0; i < nearby.count; i++)
-	{
-		Tank* tank = nearby.tank[i];
-		float2 toActor = tank->pos - this->pos;
-		float sqrDist = dot( toActor, toActor );
-		if (sqrDist < 400 && dot( toActor, dir ) > 0.35f)
-		{
-			steer -= (400 - sqrDist) * 0.02f * dot( toActor, toRight ) > 0 ? 1 : -1;
-			break;
-		}
-	}
-	// adjust heading and move
-	float speed = 1.0f;
-	if (steer < -0.2f) frame = (frame + 255 /* i.e. -1 */) & 255, dir = directions[frame], speed = 0.35f;
-	else if (steer > 0.2f) frame = (frame + 1) & 255, dir = directions[frame], speed = 0.35f;
-	else {
-		// draw tank tracks, only when not turning
-		float2 perp( -dir.y, dir.x );
-		float2 trackPos1 = pos - 9 * dir + 4.5f * perp;
-		float2 trackPos2 = pos - 9 * dir - 5.5f * perp;
-		MyApp::map.bitmap->BlendBilerp( trackPos1.x, trackPos1.y, 0, 12 );
-		MyApp::map.bitmap->BlendBilerp( trackPos2.x, trackPos2.y, 0, 12 );
-	}
-	pos += dir * speed * 0.5f;
-	// tanks never die
-	return true;
-}
-
 // Bullet constructor
 Bullet::Bullet( int2 p, int f, int a )
 {
@@ -113,19 +15,6 @@ Bullet::Bullet( int2 p, int f, int a )
 		flash = new Sprite( "assets/flash.png" );
 		bullet = new Sprite( "assets/bullet.png", make_int2( 2, 2 ), make_int2( 31, 31 ), 32, 256 );
 	}
-	// create sprite instances based on the static sprite data
-	sprite = SpriteInstance( bullet );
-	flashSprite = SpriteInstance( flash );
-}
-
-// Bullet 'undraw': erase previously rendered pixels
-void Bullet::Remove()
-{
-	// first frame uses the 'flash' sprite; subsequent frames the bullet sprite
-	if (frameCounter == 1)
-		flashSprite.Remove();
-	else
-		sprite.Remove();
 }
 
 // Bullet behaviour
@@ -137,26 +26,66 @@ bool Bullet::Tick()
 	frameCounter++;
 	if (frameCounter == 110)
 	{
-		MyApp::actorPool.push_back( new SpriteExplosion( this ) );
+		MyApp::events.SpawnSpriteExplosion( pos );
 		return false;
 	}
 	// destroy bullet if it leaves the map
 	if (pos.x < 0 || pos.y < 0 || pos.x > MyApp::map.width || pos.y > MyApp::map.height) return false;
-	// check if the bullet hit a tank
-	ActorList& tanks = MyApp::grid.FindNearbyTanks( pos );
-	for (int s = (int)tanks.count, i = 0; i < s; i++)
+	// check if the bullet hit a tank; done for all bullets at once, in Collide
+	return !spent; // stayin' alive if no tank was hit
+}
+
+// Bullet::Collide : hit test of all bullets against the tanks, on the positions
+// the bullets will have after their move in Tick. Bullets are binned by grid cell;
+// each bin gathers the tanks of the cells within the hit radius around it once (3x3
+// cells unless the grid cells are smaller than the radius), and tests all of its
+// bullets against them using squared distances. Tanks are tested in the order
+// VisitNearbyTanks visits them, so each bullet hits the same tank as a query of its
+// own would. Hits are queued in MyApp::events; Tick removes the bullets.
+void Bullet::Collide( const vector<Bullet*>& bullets )
+{
+	const Grid& grid = MyApp::grid;
+	const GridLevel& g = grid.level[0];
+	TankSystem& tanks = MyApp::tanks;
+	const float radius = 10;
+	const int reach = (int)ceilf( radius / grid.cellSize ); // cells around a bin that the radius reaches
+	bins.clear();
+	for (int s = (int)bullets.size(), i = 0; i < s; i++)
 	{
-		Tank* tank = tanks.tank[i]; // a tank, thankfully
-		if (tank->army == this->army) continue; // no friendly fire. Disable for madness.
-		float dist = length( this->pos - tank->pos );
-		if (dist < 10)
+		Bullet* b = bullets[i];
+		float2 p = b->pos + b->dir * 8;
+		// bullets that expire or leave the map in Tick hit nothing
+		if (b->frameCounter + 1 == 110 || p.x < 0 || p.y < 0 || p.x > MyApp::map.width || p.y > MyApp::map.height) continue;
+		int2 c = grid.CellPos( p );
+		bins.push_back( make_int2( c.x + c.y * g.dims.x, i ) );
+	}
+	sort( bins.begin(), bins.end(), []( int2 a, int2 b ) { return a.x < b.x || (a.x == b.x && a.y < b.y); } );
+	for (int s = (int)bins.size(), first = 0, last; first < s; first = last)
+	{
+		const int cell = bins[first].x, cx = cell % g.dims.x, cy = cell / g.dims.x;
+		for (last = first + 1; last < s && bins[last].x == cell; last++);
+		candidates.clear();
+		for (int x = max( 0, cx - reach ); x <= min( g.dims.x - 1, cx + reach ); x++)
+			for (int y = max( 0, cy - reach ); y <= min( g.dims.y - 1, cy + reach ); y++)
+			{
+				const int c = x + y * g.dims.x;
+				for (int i = g.cellStart[c], e = i + g.cellCount[c]; i < e; i++) candidates.push_back( g.tankIdx[i] );
+			}
+		for (int j = first; j < last; j++)
 		{
-			tank->hitByBullet = true; // tank will need to draw it's own conclusion
-			return false; // bees die from stinging. Disable for rail gun.
+			Bullet* b = bullets[bins[j].y];
+			float2 p = b->pos + b->dir * 8;
+			for (int t : candidates)
+			{
+				if (tanks.army[t] == b->army) continue; // no friendly fire. Disable for madness.
+				if (sqrLength( p - tanks.pos[t] ) >= radius * radius) continue;
+				// bees die from stinging; a tank that was already destroyed absorbs the bullet
+				b->spent = true;
+				if (tanks.alive[t]) MyApp::events.Hit( t ); // tank will need to draw it's own conclusion
+				break;
+			}
 		}
 	}
-	// stayin' alive
-	return true;
 }
 
 // Bullet Draw
@@ -164,30 +93,34 @@ void Bullet::Draw()
 {
 	// first frame uses the 'flash' sprite; subsequent frames the bullet sprite
 	if (frameCounter == 1 || frameCounter == 159)
-		flashSprite.Draw( Map::bitmap, pos, 0 );
+		MyApp::compositor.DrawSprite( flash, pos, 0 );
 	else
-		sprite.Draw( Map::bitmap, pos, frame );
+		MyApp::compositor.DrawSprite( bullet, pos, frame );
 }
 
 // ParticleExplosion constructor
-ParticleExplosion::ParticleExplosion( Tank* tank )
+ParticleExplosion::ParticleExplosion( Sprite* sprite, float2 p, int f )
 {
-	// read the pixels from the sprite of the specified tank
-	Sprite* sprite = tank->sprite.sprite;
+	// read the pixels from the sprite of the exploding tank
 	uint size = sprite->frameSize;
 	uint stride = sprite->frameSize * sprite->frameCount;
-	uint* src = sprite->pixels + tank->frame * size;
+	uint* src = sprite->pixels + f * size;
+	// room for two particles per pixel; the buffer is recycled, so sizes must match
+	capacity = 2 * size * size;
+	pos = (float2*)BufferPool::Alloc( BufferSize() );
+	dir = pos + capacity;
+	color = (uint*)(dir + capacity);
 	for (uint y = 0; y < size; y++) for (uint x = 0; x < size; x++)
 	{
 		uint pixel = src[x + y * stride];
 		uint alpha = pixel >> 24;
 		if (alpha > 64) for (int i = 0; i < 2; i++) // twice for a denser cloud
 		{
-			color.push_back( pixel & 0xffffff );
-			float fx = tank->pos.x - size * 0.5f + x;
-			float fy = tank->pos.y - size * 0.5f + y;
-			pos.push_back( make_float2( fx, fy ) );
-			dir.push_back( make_float2( 0, 0 ) );
+			color[count] = pixel & 0xffffff;
+			float fx = p.x - size * 0.5f + x;
+			float fy = p.y - size * 0.5f + y;
+			pos[count] = make_float2( fx, fy );
+			dir[count++] = make_float2( 0, 0 );
 		}
 	}
 }
@@ -195,26 +128,14 @@ ParticleExplosion::ParticleExplosion( Tank* tank )
 // ParticleExplosion Draw
 void ParticleExplosion::Draw()
 {
-	// create space to backup the map pixels we are about to modify
-	if (!backup) backup = new uint[(int)pos.size() * 4];
 	// draw the particles, with bilinear interpolation for smooth movement
-	for (int s = (int)pos.size(), i = 0; i < s; i++)
-	{
-		int2 intPos = make_int2( pos[i] );
-		// backup 2x2 pixels
-		backup[i * 4 + 0] = MyApp::map.bitmap->Read( intPos.x, intPos.y );
-		backup[i * 4 + 1] = MyApp::map.bitmap->Read( intPos.x + 1, intPos.y );
-		backup[i * 4 + 2] = MyApp::map.bitmap->Read( intPos.x, intPos.y + 1 );
-		backup[i * 4 + 3] = MyApp::map.bitmap->Read( intPos.x + 1, intPos.y + 1 );
-		// draw one particle with bilerp, affecting four pixels
-		MyApp::map.bitmap->BlendBilerp( pos[i].x, pos[i].y, color[i], fade );
-	}
+	MyApp::compositor.DrawPoints( pos, color, count, fade );
 }
 
 // ParticleExplosion behaviour
 bool ParticleExplosion::Tick()
 {
-	for (int s = (int)pos.size(), i = 0; i < s; i++)
+	for (int i = 0; i < count; i++)
 	{
 		// move by adding particle speed stored in dir
 		pos[i] += dir[i];
@@ -225,31 +146,22 @@ bool ParticleExplosion::Tick()
 	if (fade-- == 0) return false; else return true;
 }
 
-// ParticleExplosion 'undraw'
-void ParticleExplosion::Remove()
-{
-	// restore map pixels that we changed, in reverse order (this is important)
-	for (int s = (int)pos.size(), i = s - 1; i >= 0; i--)
-	{
-		int2 intPos = make_int2( pos[i] );
-		MyApp::map.bitmap->Plot( intPos.x, intPos.y, backup[i * 4 + 0] );
-		MyApp::map.bitmap->Plot( intPos.x + 1, intPos.y, backup[i * 4 + 1] );
-		MyApp::map.bitmap->Plot( intPos.x, intPos.y + 1, backup[i * 4 + 2] );
-		MyApp::map.bitmap->Plot( intPos.x + 1, intPos.y + 1, backup[i * 4 + 3] );
-	}
-}
-
 // SpriteExplosion constructor
-SpriteExplosion::SpriteExplosion( Bullet* bullet )
+SpriteExplosion::SpriteExplosion( float2 p )
 {
 	// load the static sprite data if it doesn't exist yet
 	if (!anim) anim = new Sprite( "assets/explosion1.png", 16 );
 	// set member variables
-	sprite = SpriteInstance( anim );
-	pos = bullet->pos;
+	pos = p;
 	frame = 0;
 }
 
+// SpriteExplosion Draw
+void SpriteExplosion::Draw()
+{
+	MyApp::compositor.DrawAdditive( anim, pos, frame - 1 );
+}
+
 // Fast dust code by George Psomathianos
 
 // Particle constructor
@@ -263,10 +175,8 @@ Particle::Particle( Sprite* s[4], float2 p[4], uint c[4], uint d[4] )
 	//dir = make_float2( -1 - RandomFloat() * 4, 0 );
 	color4 = _mm_setr_epi32( c[0], c[1], c[2], c[3] );
 	frameChange4 = _mm_setr_epi32( d[0], d[1], d[2], d[3] );
-	sprite[0] = SpriteInstance( s[0] );
-	sprite[1] = SpriteInstance( s[1] );
-	sprite[2] = SpriteInstance( s[2] );
-	sprite[3] = SpriteInstance( s[3] );
+	frame4 = _mm_setzero_si128();
+	for (int i = 0; i < 4; i++) sprite[i] = s[i];
 
 }
 
@@ -297,26 +207,18 @@ void Particle::Tick()
 		*(__m128*) & mask );
 	dir4[0] = _mm_blendv_ps( dir4[0], temp, mask );
 	dir4[1] = _mm_blendv_ps( dir4[1], zero, mask );
-	__m128 c0_02 = _mm_set1_ps( 0.02f );
-	for (int s = (int)MyApp::peaks.size(), i = 0; i < s; i++)
-	{
-		__m128 peak4[3];
-		peak4[0] = _mm_set1_ps( MyApp::peaks[i].x );
-		peak4[1] = _mm_set1_ps( MyApp::peaks[i].y );
-		peak4[2] = _mm_set1_ps( MyApp::peaks[i].z );
-		__m128 toPeak4[2];
-		toPeak4[0] = _mm_sub_ps( peak4[0], pos4[0] );
-		toPeak4[1] = _mm_sub_ps( peak4[1], pos4[1] );
-		__m128 dotToPeak4[3];
-		dotToPeak4[0] = _mm_mul_ps( peak4[0], peak4[0] );
-		dotToPeak4[1] = _mm_mul_ps( peak4[1], peak4[1] );
-		__m128 dotAdded = _mm_add_ps( dotToPeak4[0], dotToPeak4[1] );
-		__m128 sqrdot = _mm_sqrt_ps( dotAdded );
-		__m128 g4 = _mm_div_ps( _mm_mul_ps( peak4[2], c0_02 ), sqrdot );
-		dir4[1] = _mm_sub_ps( dir4[1], _mm_mul_ps( g4, _mm_div_ps( toPeak4[1], sqrdot ) ) );
-	}
+	// drift away from the peaks; one lookup per particle in the precomputed drift field
+	float2 drift[4];
+	for (int i = 0; i < 4; i++) drift[i] = MyApp::sandDrift.Sample( make_float2( pos[i], pos[i + 4] ) );
+	dir4[1] = _mm_add_ps( dir4[1], _mm_setr_ps( drift[0].y, drift[1].y, drift[2].y, drift[3].y ) );
 	__m128 random4 = _mm_set_ps( RandomFloat(), RandomFloat(), RandomFloat(), RandomFloat() );
 	dir4[1] = _mm_add_ps( dir4[1],
 		_mm_sub_ps( _mm_mul_ps( random4, c0_05 ), c0_025 ) );
 	frame4 = _mm_and_si128( _mm_add_epi32( _mm_add_epi32( frame4, frameChange4 ), c256 ), c255 );
+}
+
+// Particle Draw
+void Particle::Draw()
+{
+	for (int i = 0; i < 4; i++) MyApp::compositor.DrawSprite( sprite[i], make_float2( pos[i], pos[i + 4] ), frame[i] );
 }
\ No newline at end of file
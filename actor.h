@@ -8,68 +8,63 @@ class MyApp;
 class Actor
 {
 public:
-	enum { TANK = 0, BULLET, FLAG, PARTICLE_EXPLOSION, SPRITE_EXPLOSION };
 	Actor() = default;
-	virtual void Remove() { sprite.Remove(); }
+	virtual ~Actor() = default;
 	virtual bool Tick() = 0;
-	virtual uint GetType() = 0;
-	virtual void Draw() { sprite.Draw( Map::bitmap, pos, frame ); }
-	SpriteInstance sprite;
+	virtual void Draw() = 0;
 	float2 pos, dir;
 	int frame;
 	static inline float2* directions = 0;
 };
 
-class Tank : public Actor
-{
-public:
-	Tank( Sprite* s, int2 p, int2 t, int f, int a );
-	bool Tick();
-	uint GetType() { return Actor::TANK; }
-	float2 target;
-	int army, coolDown = 0;
-	bool hitByBullet = false;
-};
-
-class Bullet : public Actor
+class Bullet final : public Actor
 {
 public:
 	Bullet( int2 p, int f, int a );
-	void Remove();
+	static void* operator new( size_t ) { return pool.Alloc(); }
+	static void operator delete( void* p ) { pool.Free( p ); }
 	bool Tick();
 	void Draw();
-	uint GetType() { return Actor::BULLET; }
-	SpriteInstance flashSprite;
+	static void Collide( const vector<Bullet*>& bullets );
 	int frameCounter, army;
+	bool spent = false; // hit a tank, see Collide
 	static inline Sprite* flash = 0, * bullet = 0;
+	static inline Pool<Bullet> pool;
+	static inline vector<int2> bins; // scratch for Collide: (cell, bullet) pairs
+	static inline vector<int> candidates;
 };
 
-class ParticleExplosion : public Actor
+class ParticleExplosion final : public Actor
 {
 public:
 	ParticleExplosion() = default;
-	ParticleExplosion( Tank* tank );
-	~ParticleExplosion() { delete backup; }
-	void Remove();
+	ParticleExplosion( Sprite* sprite, float2 p, int f );
+	~ParticleExplosion() { BufferPool::Free( pos, BufferSize() ); }
+	static void* operator new( size_t ) { return pool.Alloc(); }
+	static void operator delete( void* p ) { pool.Free( p ); }
 	bool Tick();
 	void Draw();
-	uint GetType() { return Actor::PARTICLE_EXPLOSION; }
-	vector<float2> pos;
-	vector<float2> dir;
-	vector<uint> color;
-	uint* backup = 0;
+	size_t BufferSize() const { return capacity * (2 * sizeof( float2 ) + sizeof( uint )); }
+	// particle data, in one pooled buffer sized for the largest possible cloud
+	float2* pos = 0;
+	float2* dir = 0;
+	uint* color = 0;
+	int count = 0, capacity = 0;
 	uint fade = 255;
+	static inline Pool<ParticleExplosion> pool;
 };
 
-class SpriteExplosion : public Actor
+class SpriteExplosion final : public Actor
 {
 public:
 	SpriteExplosion() = default;
-	SpriteExplosion( Bullet* bullet );
-	bool Tick() { if (++frame == 16) return false; }
-	void Draw() { sprite.DrawAdditive( Map::bitmap, pos, frame - 1 ); }
-	uint GetType() { return Actor::SPRITE_EXPLOSION; }
+	SpriteExplosion( float2 p );
+	static void* operator new( size_t ) { return pool.Alloc(); }
+	static void operator delete( void* p ) { pool.Free( p ); }
+	bool Tick() { return ++frame < 16; }
+	void Draw();
 	static inline Sprite* anim = 0;
+	static inline Pool<SpriteExplosion> pool;
 };
 
 class Particle
@@ -77,17 +72,11 @@ class Particle
 public:
 	Particle() = default;
 	Particle( Sprite* s[4], float2 p[4], uint c[4], uint d[4] );
-	void Remove() { sprite[0].Remove(); sprite[1].Remove(); sprite[2].Remove(); sprite[3].Remove(); }
 	void Tick();
-	void Draw() {
-		sprite[0].Draw( Map::bitmap, float2( pos[0], pos[4] ), frame[0] );
-		sprite[1].Draw( Map::bitmap, float2( pos[1], pos[5] ), frame[1] );
-		sprite[2].Draw( Map::bitmap, float2( pos[2], pos[6] ), frame[2] );
-		sprite[3].Draw( Map::bitmap, float2( pos[3], pos[7] ), frame[3] );
-	}
+	void Draw();
 	//uint backup[4], color = 0, frame, frameChange;
 	//bool hasBackup = false;
-	SpriteInstance sprite[4];
+	Sprite* sprite[4];
 	//float2 pos;
 	union { __m128 pos4[2]; float pos[8]; };
 	//float2 dir;
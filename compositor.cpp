@@ -0,0 +1,96 @@
+#include "precomp.h"
+
+// BlendBilerp : Surface::BlendBilerp, limited to the pixels in clip
+static void BlendBilerp( Surface* target, float x, float y, uint c, uint w, const int4& clip )
+{
+	const int2 p = make_int2( (int)x, (int)y );
+	if (p.x + 1 < clip.x || p.y + 1 < clip.y || p.x >= clip.z || p.y >= clip.w) return;
+	const float fx = x - p.x, fy = y - p.y;
+	const int weight[4] = {
+		(int)(256 * ((1 - fx) * (1 - fy))), (int)(256 * (fx * (1 - fy))),
+		(int)(256 * ((1 - fx) * fy)), (int)(256 * (fx * fy)) };
+	for (int i = 0; i < 4; i++)
+	{
+		const int px = p.x + (i & 1), py = p.y + (i >> 1);
+		if (px < clip.x || py < clip.y || px >= clip.z || py >= clip.w) continue;
+		uint& d = target->pixels[px + py * target->width];
+		const uint wi = (weight[i] * w) >> 8;
+		d = ScaleColor( c, wi ) + ScaleColor( d, 255 - wi );
+	}
+}
+
+// Compositor::Render : draw and clear the queued commands; the map reports the
+// covered screen tiles, which its next Draw restores
+void Compositor::Render( Surface* target, Map& map )
+{
+	const ScreenTransform view = map.Transform();
+	const int4 screen = make_int4( 0, 0, target->width, target->height );
+	const int TILE = Map::TILE, tilesX = (target->width + TILE - 1) / TILE, tilesY = (target->height + TILE - 1) / TILE;
+	// a point covers one map pixel; when zoomed out, that is less than a screen pixel
+	const float coverage = min( 1.0f, view.scale.x * view.scale.y );
+	// find the screen rectangle of each command, and count the commands per tile
+	const int count = (int)commands.size();
+	rects.resize( count );
+	binStart.assign( tilesX * tilesY + 1, 0 );
+	for (int i = 0; i < count; i++)
+	{
+		const Command& c = commands[i];
+		int4 r = make_int4( INT_MAX, INT_MAX, INT_MIN, INT_MIN ); // pixels, inclusive
+		if (c.type == POINTS) for (int j = 0; j < c.frame; j++)
+		{
+			const float2 p = view.ToScreen( c.points[j] );
+			if (p.x < 0 || p.y < 0 || p.x >= screen.z || p.y >= screen.w) continue;
+			r = make_int4( min( r.x, (int)p.x ), min( r.y, (int)p.y ), max( r.z, (int)p.x + 1 ), max( r.w, (int)p.y + 1 ) );
+		}
+		else
+		{
+			const int4 s = c.sprite->ScreenRect( view, c.pos, screen );
+			if (s.x < s.z && s.y < s.w) r = make_int4( s.x, s.y, s.z - 1, s.w - 1 );
+		}
+		if (r.x > r.z) { rects[i] = make_int4( 0, 0, -1, -1 ); continue; }
+		map.Cover( r.x, r.y, r.z, r.w );
+		r = make_int4( r.x / TILE, r.y / TILE, min( r.z / TILE, tilesX - 1 ), min( r.w / TILE, tilesY - 1 ) );
+		rects[i] = r;
+		for (int y = r.y; y <= r.w; y++) for (int x = r.x; x <= r.z; x++) binStart[x + y * tilesX + 1]++;
+	}
+	// turn the counts into offsets, then fill the bins in submission order
+	active.clear();
+	for (int t = 0; t < tilesX * tilesY; t++)
+	{
+		if (binStart[t + 1]) active.push_back( t );
+		binStart[t + 1] += binStart[t];
+	}
+	bins.resize( binStart.back() );
+	for (int i = 0; i < count; i++)
+	{
+		const int4 r = rects[i];
+		for (int y = r.y; y <= r.w; y++) for (int x = r.x; x <= r.z; x++) bins[binStart[x + y * tilesX]++] = i;
+	}
+	// filling advanced each offset to the start of the next tile
+	for (int t = tilesX * tilesY; t > 0; t--) binStart[t] = binStart[t - 1];
+	binStart[0] = 0;
+	// tiles are disjoint, so they draw in parallel; their loads differ a lot
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < (int)active.size(); i++)
+	{
+		const int t = active[i], tx = t % tilesX, ty = t / tilesX;
+		const int4 clip = make_int4( tx * TILE, ty * TILE, min( (tx + 1) * TILE, screen.z ), min( (ty + 1) * TILE, screen.w ) );
+		for (int j = binStart[t]; j < binStart[t + 1]; j++)
+		{
+			const Command& c = commands[bins[j]];
+			if (c.type == SPRITE) c.sprite->Draw( target, view, c.pos, c.frame, clip );
+			else if (c.type == ADDITIVE) c.sprite->DrawAdditive( target, view, c.pos, c.frame, clip );
+			else
+			{
+				const uint weight = (uint)(c.weight * coverage);
+				for (int k = 0; k < c.frame; k++)
+				{
+					const float2 p = view.ToScreen( c.points[k] );
+					if (p.x < 0 || p.y < 0 || p.x >= screen.z || p.y >= screen.w) continue;
+					BlendBilerp( target, p.x, p.y, c.colors[k], weight, clip );
+				}
+			}
+		}
+	}
+	commands.clear();
+}
\ No newline at end of file
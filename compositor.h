@@ -0,0 +1,38 @@
+#pragma once
+
+namespace Tmpl8
+{
+
+// Moving objects do not draw into the map bitmap. They queue draw commands during
+// the frame, and Render draws them over the screen after Map::Draw, through the view
+// transform, in the order they were queued. The terrain is read-only apart from
+// persistent decals (tank tracks), so nothing is backed up and restored.
+// Render bins the commands by the screen tiles they overlap and draws the tiles in
+// parallel, each clipped to its tile; within a tile, commands keep their order, so
+// every pixel sees the same sequence of writes as a serial pass.
+class Compositor
+{
+public:
+	enum { SPRITE, ADDITIVE, POINTS };
+	struct Command
+	{
+		int type = SPRITE, frame = 0;	// frame: sprite frame, or number of points
+		float2 pos = {};				// sprite centre on the map
+		const Sprite* sprite = 0;
+		const float2* points = 0;		// map positions of the points, drawn with bilinear
+		const uint* colors = 0;			// per point colour
+		uint weight = 0;				// blend weight of all points, as in Surface::BlendBilerp
+	};
+	void DrawSprite( const Sprite* s, float2 pos, int frame ) { commands.push_back( { SPRITE, frame, pos, s } ); }
+	void DrawAdditive( const Sprite* s, float2 pos, int frame ) { commands.push_back( { ADDITIVE, frame, pos, s } ); }
+	void DrawPoints( const float2* p, const uint* c, int count, uint w ) { commands.push_back( { POINTS, count, {}, 0, p, c, w } ); }
+	void Render( Surface* target, Map& map );
+	vector<Command> commands;
+private:
+	vector<int4> rects;		// per command: the covered screen tiles, inclusive
+	vector<int> binStart;	// per screen tile: first entry in bins
+	vector<int> bins;		// command indices, grouped by tile, in submission order
+	vector<int> active;		// tiles with at least one command
+};
+
+} // namespace Tmpl8
\ No newline at end of file
@@ -0,0 +1,36 @@
+#include "precomp.h"
+#include <omp.h>
+
+// Events constructor : one queue for each thread OpenMP may use
+Events::Events()
+{
+	queues.resize( max( 1, omp_get_max_threads() ) );
+}
+
+// Events::Local : the queue of the calling thread. Producers must run in a single
+// level of parallelism: in nested teams, thread numbers repeat across teams.
+Events::Queue& Events::Local()
+{
+	const int thread = omp_get_thread_num();
+	if (thread >= (int)queues.size()) FatalError( "Events: thread %i, but there are %i queues", thread, (int)queues.size() );
+#if _OPENMP >= 200805 // omp_get_active_level is OpenMP 3.0; MSVC /openmp is 2.0
+	if (omp_get_active_level() > 1) FatalError( "Events: queued from a nested parallel region" );
+#endif
+	return queues[thread];
+}
+
+// Events::Flush : apply all queued events, in thread order; call from the main thread.
+// Afterwards, adds queues if omp_set_num_threads raised the thread count.
+void Events::Flush()
+{
+	for (Queue& q : queues)
+	{
+		MyApp::tanks.hits.insert( MyApp::tanks.hits.end(), q.hits.begin(), q.hits.end() );
+		for (const BulletSpawn& b : q.bullets) MyApp::bullets.push_back( new Bullet( b.pos, b.frame, b.army ) );
+		for (const ParticleExplosionSpawn& e : q.particleExplosions)
+			MyApp::particleExplosions.push_back( new ParticleExplosion( e.sprite, e.pos, e.frame ) );
+		for (const float2& p : q.spriteExplosions) MyApp::spriteExplosions.push_back( new SpriteExplosion( p ) );
+		q.hits.clear(), q.bullets.clear(), q.particleExplosions.clear(), q.spriteExplosions.clear();
+	}
+	if ((int)queues.size() < omp_get_max_threads()) queues.resize( omp_get_max_threads() );
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#pragma once
+
+namespace Tmpl8
+{
+
+// Deferred side effects: bullet hits and actor spawns. Producers may run on any
+// thread; each thread queues into its own queue, so nothing is shared and no actor
+// container changes while it is being iterated. Flush applies the queued events
+// at a sync point, on the main thread. Queues are merged in thread order, which for
+// a schedule(static) loop is the order of the loop itself, so the result does not
+// depend on the number of threads.
+class Events
+{
+public:
+	Events();
+	void Hit( int tank ) { Local().hits.push_back( tank ); }
+	void SpawnBullet( int2 pos, int frame, int army ) { Local().bullets.push_back( { pos, frame, army } ); }
+	void SpawnParticleExplosion( Sprite* sprite, float2 pos, int frame ) { Local().particleExplosions.push_back( { sprite, pos, frame } ); }
+	void SpawnSpriteExplosion( float2 pos ) { Local().spriteExplosions.push_back( pos ); }
+	void Flush();
+private:
+	struct BulletSpawn { int2 pos; int frame, army; };
+	struct ParticleExplosionSpawn { Sprite* sprite; float2 pos; int frame; };
+	struct alignas( 64 ) Queue // one per thread, on its own cache lines
+	{
+		vector<int> hits;
+		vector<BulletSpawn> bullets;
+		vector<ParticleExplosionSpawn> particleExplosions;
+		vector<float2> spriteExplosions;
+	};
+	Queue& Local();
+	vector<Queue> queues;
+};
+
+} // namespace Tmpl8
\ No newline at end of file
@@ -1,5 +1,9 @@
 #include "precomp.h"
+#ifdef _MSC_VER
 #include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
 
 // Optimized flag code by Erik Welling.
 
@@ -11,7 +15,6 @@ VerletFlag::VerletFlag( int2 location, Surface* pattern )
 	pos = new float2[width * height];
 	prevPos = new float2[width * height];
 	color = new uint[width * height];
-	backup = new uint[width * height * 4];
 	memcpy( color, pattern->pixels, width * height * 4 );
 	for (int x = 0; x < width; x++) for (int y = 0; y < height; y++)
 		pos[x + y * width] = make_float2( location.x - x * 1.2f, y * 1.2f + location.y );
@@ -20,30 +23,16 @@ VerletFlag::VerletFlag( int2 location, Surface* pattern )
 
 void VerletFlag::Draw()
 {
-	for (int x = 0; x < width; x++) {
-		int index = x;
-		for (int y = 0; y < height; y++)
-		{
-			float2 p = pos[index];
-			int2 intPos = make_int2( p );
-			backup[index * 4 + 0] = MyApp::map.bitmap->Read( intPos.x, intPos.y );
-			backup[index * 4 + 1] = MyApp::map.bitmap->Read( intPos.x + 1, intPos.y );
-			backup[index * 4 + 2] = MyApp::map.bitmap->Read( intPos.x, intPos.y + 1 );
-			backup[index * 4 + 3] = MyApp::map.bitmap->Read( intPos.x + 1, intPos.y + 1 );
-			hasBackup = true;
-			MyApp::map.bitmap->PlotBilerp( p.x, p.y, color[index] );
-			index += width;
-		}
-	}
+	MyApp::compositor.DrawPoints( pos, color, width * height, 256 ); // as PlotBilerp
 }
 
 float fastInvSqrt( float number ) {
-	long i;
-	float x2, y;
-	y = number;
-	i = *(long*)&y;
+	// int32_t rather than long: long is 64 bits on Linux
+	int32_t i;
+	float y = number;
+	memcpy( &i, &y, 4 );
 	i = 0x5f3759df - (i >> 1);
-	y = *(float*)&i;
+	memcpy( &y, &i, 4 );
 	return y;
 }
 
@@ -112,17 +101,4 @@ bool VerletFlag::Tick()
 	}
 	// all done
 	return true; // flags don't die
-}
-
-void VerletFlag::Remove()
-{
-	if (hasBackup) for (int x = width - 1; x >= 0; x--) for (int y = height - 1; y >= 0; y--)
-	{
-		int index = x + y * width;
-		int2 intPos = make_int2( pos[index] );
-		MyApp::map.bitmap->Plot( intPos.x, intPos.y, backup[index * 4 + 0] );
-		MyApp::map.bitmap->Plot( intPos.x + 1, intPos.y, backup[index * 4 + 1] );
-		MyApp::map.bitmap->Plot( intPos.x, intPos.y + 1, backup[index * 4 + 2] );
-		MyApp::map.bitmap->Plot( intPos.x + 1, intPos.y + 1, backup[index * 4 + 3] );
-	}
 }
\ No newline at end of file
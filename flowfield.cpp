@@ -0,0 +1,123 @@
+#include "precomp.h"
+#include <queue>
+
+// FlowField::Init : derive the travel cost of each cell from the mountain peaks
+void FlowField::Init( int2 mapSize, const vector<float3>& peaks, int cell )
+{
+	cellSize = cell;
+	invCellSize = 1.0f / cellSize;
+	width = (mapSize.x + cellSize - 1) / cellSize;
+	height = (mapSize.y + cellSize - 1) / cellSize;
+	cost.resize( width * height );
+	for (int y = 0; y < height; y++) for (int x = 0; x < width; x++)
+	{
+		// within the repulsion radius of a peak tanks get pushed back, so avoid it;
+		// elsewhere tanks drive at full speed, as does the open terrain beyond the
+		// map edge (see Build)
+		float c = 1;
+		float2 centre = make_float2( (x + 0.5f) * cellSize, (y + 0.5f) * cellSize );
+		for (int s = (int)peaks.size(), i = 0; i < s; i++)
+		{
+			float radius = peaks[i].z / 2, dist = length( make_float2( peaks[i].x, peaks[i].y ) - centre );
+			if (dist < radius) c += 16 * (1 - dist / radius);
+		}
+		cost[x + y * width] = c;
+	}
+	dir.clear(), target.clear(), users.clear();
+}
+
+// FlowField::Acquire : field index for a target, building the field if needed; a
+// released field keeps its directions until it is recycled, so it can be reused
+int FlowField::Acquire( float2 t )
+{
+	int field = -1;
+	for (int s = (int)target.size(), i = 0; i < s; i++)
+	{
+		if (target[i].x == t.x && target[i].y == t.y) { users[i]++; return i; }
+		if (users[i] == 0 && field == -1) field = i;
+	}
+	if (field == -1)
+	{
+		field = (int)target.size();
+		target.push_back( t ), users.push_back( 0 );
+		dir.resize( target.size() * width * height );
+	}
+	target[field] = t, users[field] = 1;
+	Build( field );
+	return field;
+}
+
+// FlowField::Direction : heading towards the target of a field; bilinear between
+// cell centres, so it turns smoothly from cell to cell. TankSystem::Steer8 repeats
+// this math, so it must round as written.
+PRECISE_FP_BEGIN
+float2 FlowField::Direction( int field, float2 pos ) const
+{
+	float u = clamp( pos.x * invCellSize - 0.5f, 0.0f, (float)(width - 1) );
+	float v = clamp( pos.y * invCellSize - 0.5f, 0.0f, (float)(height - 1) );
+	int iu = min( (int)u, width - 2 ), iv = min( (int)v, height - 2 );
+	float fu = u - iu, fv = v - iv;
+	const float2* d = dir.data() + field * width * height + iu + iv * width;
+	float2 blend = (d[0] * (1 - fu) + d[1] * fu) * (1 - fv) + (d[width] * (1 - fu) + d[width + 1] * fu) * fv;
+	return dot( blend, blend ) > 0 ? normalize( blend ) : d[0];
+}
+PRECISE_FP_END
+
+// FlowField::Build : fast marching (Dijkstra order, eikonal update) from the target
+// over the cost grid, then point every cell down the distance gradient. A target
+// outside the map is reached over open terrain: map edge cells start at their
+// straight-line distance to it.
+void FlowField::Build( int field )
+{
+	typedef pair<float, int> Node;
+	priority_queue<Node, vector<Node>, greater<Node>> open;
+	const float2 t = target[field] * invCellSize - make_float2( 0.5f ); // in cell units
+	const int tx = (int)floorf( t.x + 0.5f ), ty = (int)floorf( t.y + 0.5f );
+	const float far = 1e30f;
+	distance.assign( width * height, far );
+	accepted.assign( width * height, 0 );
+	if (tx >= 0 && ty >= 0 && tx < width && ty < height) open.push( Node( distance[tx + ty * width] = 0, tx + ty * width ) );
+	else for (int y = 0; y < height; y++) for (int x = 0; x < width; x++) if (x == 0 || y == 0 || x == width - 1 || y == height - 1)
+	{
+		int c = x + y * width;
+		open.push( Node( distance[c] = length( make_float2( (float)x, (float)y ) - t ), c ) );
+	}
+	// smallest accepted distance of a cell's two neighbours along x or y
+	auto known = [&]( int x, int y, int dx, int dy )
+	{
+		float d = far;
+		if (x - dx >= 0 && y - dy >= 0 && accepted[(x - dx) + (y - dy) * width]) d = distance[(x - dx) + (y - dy) * width];
+		if (x + dx < width && y + dy < height && accepted[(x + dx) + (y + dy) * width]) d = min( d, distance[(x + dx) + (y + dy) * width] );
+		return d;
+	};
+	static const int nx4[4] = { -1, 1, 0, 0 }, ny4[4] = { 0, 0, -1, 1 };
+	while (!open.empty())
+	{
+		Node node = open.top();
+		open.pop();
+		if (accepted[node.second]) continue; // stale entry
+		accepted[node.second] = 1;
+		int x = node.second % width, y = node.second / width;
+		for (int i = 0; i < 4; i++)
+		{
+			int nx = x + nx4[i], ny = y + ny4[i], n = nx + ny * width;
+			if (nx < 0 || ny < 0 || nx >= width || ny >= height || accepted[n]) continue;
+			// solve |grad d| = cost with the accepted neighbours
+			float a = known( nx, ny, 1, 0 ), b = known( nx, ny, 0, 1 ), c = cost[n];
+			if (a > b) swap( a, b );
+			float d = b - a >= c ? a + c : 0.5f * (a + b + sqrtf( 2 * c * c - (b - a) * (b - a) ));
+			if (d < distance[n]) open.push( Node( distance[n] = d, n ) );
+		}
+	}
+	// directions: down the distance gradient, or straight at the target where it is flat
+	float2* cells = dir.data() + field * width * height;
+	for (int y = 0; y < height; y++) for (int x = 0; x < width; x++)
+	{
+		int x0 = max( 0, x - 1 ), x1 = min( width - 1, x + 1 ), y0 = max( 0, y - 1 ), y1 = min( height - 1, y + 1 );
+		float2 down = make_float2( (distance[x0 + y * width] - distance[x1 + y * width]) / (x1 - x0),
+			(distance[x + y0 * width] - distance[x + y1 * width]) / (y1 - y0) );
+		if (dot( down, down ) < 1e-6f) down = t - make_float2( (float)x, (float)y );
+		cells[x + y * width] = dot( down, down ) > 0 ? normalize( down ) : make_float2( 0, -1 );
+	}
+	builds++;
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+#pragma once
+
+namespace Tmpl8
+{
+
+// Navigation fields: one direction field per distinct tank target, built with a
+// fast marching (eikonal) solve over a coarse cost grid derived from the mountain
+// peaks. A tank reads its heading towards the target with one bilinear lookup.
+// Fields are built lazily when a new target appears; fields that no tank uses
+// anymore are recycled.
+class FlowField
+{
+public:
+	FlowField() = default;
+	void Init( int2 mapSize, const vector<float3>& peaks, int cellSize = 16 );
+	int Acquire( float2 target );
+	void Release( int field ) { users[field]--; }
+	float2 Direction( int field, float2 pos ) const;
+	int width = 0, height = 0, cellSize = 16;
+	float invCellSize = 0;
+	vector<float> cost;		// cost of crossing each cell, 1 away from peaks
+	vector<float2> dir;		// unit direction per cell, for all fields back to back
+	vector<float2> target;	// target of each field
+	vector<int> users;		// tanks using each field; 0 means the slot can be reused
+	int builds = 0;			// fields built so far
+private:
+	void Build( int field );
+	vector<float> distance;	// scratch for Build
+	vector<uchar> accepted;
+};
+
+} // namespace Tmpl8
\ No newline at end of file
@@ -0,0 +1,102 @@
+#include "precomp.h"
+
+// ForceField::Build : evaluate the exact force at every node
+void ForceField::Build( int2 size, const vector<float3>& peaks, Evaluator evaluate, int cell )
+{
+	mapSize = size;
+	cellSize = cell;
+	invCellSize = 1.0f / cellSize;
+	// tanks may leave the map; a margin of the largest peak radius (255 / 2) keeps
+	// their probe inside the field wherever a peak can still reach them
+	margin = (128 + cellSize - 1) / cellSize;
+	width = (mapSize.x + cellSize - 1) / cellSize + 2 * margin;
+	height = (mapSize.y + cellSize - 1) / cellSize + 2 * margin;
+	FREE64( force );
+	force = (float2*)MALLOC64( width * height * sizeof( float2 ) );
+	for (int y = 0; y < height; y++) for (int x = 0; x < width; x++)
+	{
+		float2 nodePos = make_float2( (x - margin + 0.5f) * cellSize, (y - margin + 0.5f) * cellSize );
+		force[x + y * width] = evaluate( peaks, nodePos );
+	}
+}
+
+// ForceField::Sample : bilinear lookup; positions beyond the margin get the border value.
+// TankSystem::Steer8 repeats this math, so it must round as written.
+PRECISE_FP_BEGIN
+float2 ForceField::Sample( float2 pos ) const
+{
+	float u = clamp( pos.x * invCellSize + (margin - 0.5f), 0.0f, (float)(width - 1) );
+	float v = clamp( pos.y * invCellSize + (margin - 0.5f), 0.0f, (float)(height - 1) );
+	int iu = min( (int)u, width - 2 ), iv = min( (int)v, height - 2 );
+	float fu = u - iu, fv = v - iv;
+	const float2* f = force + iu + iv * width;
+	return (f[0] * (1 - fu) + f[1] * fu) * (1 - fv) + (f[width] * (1 - fu) + f[width + 1] * fu) * fv;
+}
+PRECISE_FP_END
+
+// ForceField::MeasureError : mean and 99th percentile of the deviation from the exact force
+void ForceField::MeasureError( const vector<float3>& peaks, Evaluator evaluate, int samples, float& mean, float& p99 ) const
+{
+	uint seed = 0x2345; // local seed: validation must not disturb the game's random sequence
+	vector<float> error( samples );
+	double sum = 0;
+	for (int i = 0; i < samples; i++)
+	{
+		float2 pos = make_float2( RandomFloat( seed ) * mapSize.x, RandomFloat( seed ) * mapSize.y );
+		sum += error[i] = length( Sample( pos ) - evaluate( peaks, pos ) );
+	}
+	sort( error.begin(), error.end() );
+	mean = (float)(sum / samples);
+	p99 = error[(samples * 99) / 100];
+}
+
+// ForceField::PeakRepulsion : mountains push tanks away; this is the force that was
+// accumulated per tank in the steering code, i.e. steer += dot( toRight, force )
+float2 ForceField::PeakRepulsion( const vector<float3>& peaks, float2 pos )
+{
+	float2 force = make_float2( 0 );
+	for (int s = (int)peaks.size(), i = 0; i < s; i++)
+	{
+		float peakMag = peaks[i].z / 2;
+		float2 toPeak = make_float2( peaks[i].x, peaks[i].y ) - pos;
+		float sqrDist = dot( toPeak, toPeak );
+		if (sqrDist < sqrf( peakMag ) && sqrDist > 0 /* no direction at the peak itself */)
+			toPeak = normalize( toPeak ),
+			force -= toPeak * peakMag / sqrtf( sqrDist );
+	}
+	return force;
+}
+
+// ForceField::PeakDrift : vertical drift of sand particles, as previously evaluated
+// per particle in Particle::Tick (note: it scales by the peak's distance to the
+// map origin, not to the particle; kept as is to preserve the sand's look)
+float2 ForceField::PeakDrift( const vector<float3>& peaks, float2 pos )
+{
+	float2 force = make_float2( 0 );
+	for (int s = (int)peaks.size(), i = 0; i < s; i++)
+	{
+		float sqrdot = sqrtf( peaks[i].x * peaks[i].x + peaks[i].y * peaks[i].y );
+		float g = (peaks[i].z * 0.02f) / sqrdot;
+		force.y -= g * ((peaks[i].y - pos.y) / sqrdot);
+	}
+	return force;
+}
+
+// ForceField::Benchmark : build the tank and sand fields as MyApp::Init does, and
+// report the build time and how well the fields match the exact forces
+void ForceField::Benchmark( int2 mapSize, const vector<float3>& peaks )
+{
+	ForceField tank, sand;
+	Timer timer;
+	tank.Build( mapSize, peaks, PeakRepulsion );
+	const float tankTime = timer.elapsed() * 1000;
+	timer.reset();
+	sand.Build( mapSize, peaks, PeakDrift, SAND_CELL );
+	const float sandTime = timer.elapsed() * 1000;
+	float tankMean, tankP99, sandMean, sandP99;
+	tank.MeasureError( peaks, PeakRepulsion, 65536, tankMean, tankP99 );
+	sand.MeasureError( peaks, PeakDrift, 65536, sandMean, sandP99 );
+	printf( "force fields, %i peaks      build ms   error mean        99%%\n", (int)peaks.size() );
+	printf( "tanks, %2i px cells        %8.2f   %10.6f %10.6f\n", tank.cellSize, tankTime, tankMean, tankP99 );
+	printf( "sand, %2i px cells         %8.2f   %10.6f %10.6f\n", sand.cellSize, sandTime, sandMean, sandP99 );
+}
\ No newline at end of file
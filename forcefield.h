@@ -0,0 +1,28 @@
+#pragma once
+
+namespace Tmpl8
+{
+
+// Low-resolution float2 vector field covering the map (plus a margin), built once
+// at load time and sampled with a single bilinear lookup. Replaces loops over all
+// mountain peaks in the tank and sand updates.
+class ForceField
+{
+public:
+	typedef float2 (*Evaluator)( const vector<float3>& peaks, float2 pos );
+	enum { SAND_CELL = 16 }; // cell size of the sand drift field; linear in y, so coarse is exact
+	ForceField() = default;
+	void Build( int2 mapSize, const vector<float3>& peaks, Evaluator evaluate, int cellSize = 4 );
+	float2 Sample( float2 pos ) const;
+	void MeasureError( const vector<float3>& peaks, Evaluator evaluate, int samples, float& mean, float& p99 ) const;
+	// exact per-peak forces; used to build the fields and as a reference
+	static float2 PeakRepulsion( const vector<float3>& peaks, float2 pos );
+	static float2 PeakDrift( const vector<float3>& peaks, float2 pos );
+	static void Benchmark( int2 mapSize, const vector<float3>& peaks );
+	float2* force = 0;
+	int width = 0, height = 0, cellSize = 4, margin = 0;
+	float invCellSize = 0;
+	int2 mapSize;
+};
+
+} // namespace Tmpl8
\ No newline at end of file
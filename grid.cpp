@@ -1,51 +1,171 @@
 #include "precomp.h"
 
-void Grid::Clear()
+// GridLevel::Init : set the resolution; contents are built by Populate
+void GridLevel::Init( int2 cells, int s )
 {
-	for( int i = 0; i < GRIDSIZE * GRIDSIZE; i++ ) cell[i].count = 0;
+	shift = s;
+	dims = make_int2( ((cells.x - 1) >> shift) + 1, ((cells.y - 1) >> shift) + 1 );
+	cellStart.clear();
 }
 
-void Grid::Populate( const vector<Actor*>& actors )
+// GridLevel::Populate : rebuild the level with a two-pass counting sort
+void GridLevel::Populate( const TankSystem& tanks, const int2* fineCell )
 {
-	int2 mapSize = MyApp::map.MapSize();
-	float2 posScale = GRIDSIZE * make_float2( 1.0f / mapSize.x, 1.0f / mapSize.y );
-	for( int s = (int)actors.size(), i = 0; i < s; i++ ) if (actors[i]->GetType() == Actor::TANK)
+	const int count = tanks.Count(), cellTotal = dims.x * dims.y;
+	cellStart.resize( cellTotal + 1 );
+	cellCount.assign( cellTotal, 0 );
+	tankCell.resize( count ), tankSlot.resize( count );
+	// pass 1: count tanks per cell
+	for (int i = 0; i < count; i++) cellCount[tankCell[i] = CellIndex( fineCell[i] )]++;
+	// reserve half again plus a few slots per cell, so tanks can migrate in place
+	cellStart[0] = 0;
+	for (int c = 0; c < cellTotal; c++) cellStart[c + 1] = cellStart[c] + cellCount[c] + cellCount[c] / 2 + 8;
+	tankIdx.resize( cellStart.back() ), tankPos.resize( cellStart.back() );
+	// pass 2: scatter; within a cell, tanks are in index order
+	cellCount.assign( cellTotal, 0 );
+	for (int i = 0; i < count; i++)
 	{
-		// calculate actor position in grid space
-		int2 gridPos = make_int2( posScale * actors[i]->pos );
-		// add actor to cell
-		if (gridPos.x < 0 || gridPos.y < 0 || gridPos.x >= GRIDSIZE || gridPos.y >= GRIDSIZE) continue;
-		ActorList& c = cell[gridPos.x + gridPos.y * GRIDSIZE];
-		c.tank[c.count++ & (CELLCAPACITY - 1) /* better than overflow */] = (Tank*)actors[i];
+		int c = tankCell[i], slot = cellStart[c] + cellCount[c]++;
+		tankIdx[slot] = i;
+		tankPos[slot] = tanks.pos[i];
+		tankSlot[i] = slot;
 	}
 }
 
-ActorList& Grid::FindNearbyTanks( Tank* tank, float radius )
+// GridLevel::Update : incremental maintenance; only tanks that changed cell move in
+// the index, new tanks (at the end of the tank list) are inserted. Returns the
+// number of tanks that changed cell.
+int GridLevel::Update( const TankSystem& tanks, const int2* fineCell )
 {
-	return FindNearbyTanks( tank->pos, radius, tank );
+	if (cellStart.empty()) { Populate( tanks, fineCell ); return 0; }
+	int migrations = 0;
+	for (int s = tanks.Count(), i = 0; i < s; i++)
+	{
+		int c = CellIndex( fineCell[i] );
+		if (i >= (int)tankCell.size())
+		{
+			// spawned since the last update
+			tankCell.push_back( -1 ), tankSlot.push_back( -1 );
+			if (!Insert( i, c, tanks.pos[i] )) { Populate( tanks, fineCell ); return migrations; }
+		}
+		else if (c == tankCell[i]) tankPos[tankSlot[i]] = tanks.pos[i];
+		else
+		{
+			Unlink( i );
+			if (!Insert( i, c, tanks.pos[i] )) { Populate( tanks, fineCell ); return migrations; }
+			migrations++;
+		}
+	}
+	return migrations;
 }
 
-ActorList& Grid::FindNearbyTanks( float2 position, float radius, Tank* tank )
+// GridLevel::Remove : despawn; tank 'last' takes the index of the removed tank, as
+// in TankSystem::Compact
+void GridLevel::Remove( int tank, int last )
 {
-	int2 mapSize = MyApp::map.MapSize();
-	float2 posScale = GRIDSIZE * make_float2( 1.0f / mapSize.x, 1.0f / mapSize.y );
-	int2 gridPos = make_int2( posScale * position );
-	int2 topLeft( max( 0, gridPos.x - 1 ), max( 0, gridPos.y - 1 ) );
-	int2 bottomRight( min( GRIDSIZE - 1, gridPos.x + 1 ), min( GRIDSIZE - 1, gridPos.y + 1 ) );
-	answer.count = 0;
-	for (int x = topLeft.x; x <= bottomRight.x; x++)
+	Unlink( tank );
+	if (tank != last)
 	{
-		for (int y = topLeft.y; y <= bottomRight.y; y++)
-		{
-			for (int i = 0; i < cell[x + y * GRIDSIZE].count; i++)
-			{
-				Tank* other = cell[x + y * GRIDSIZE].tank[i];
-				if (other == tank) continue;
-				float sqrDist = sqrLength( other->pos - position );
-				if (sqrDist > radius * radius) continue;
-				answer.tank[answer.count++ & (CELLCAPACITY - 1)] = other;
-			}
-		}
+		tankCell[tank] = tankCell[last];
+		tankSlot[tank] = tankSlot[last];
+		tankIdx[tankSlot[tank]] = tank;
+	}
+	tankCell.pop_back(), tankSlot.pop_back();
+}
+
+// GridLevel::Unlink : take a tank out of its cell; the last entry of the cell fills the gap
+void GridLevel::Unlink( int tank )
+{
+	int c = tankCell[tank], slot = tankSlot[tank];
+	int lastSlot = cellStart[c] + --cellCount[c];
+	if (slot != lastSlot)
+	{
+		tankIdx[slot] = tankIdx[lastSlot];
+		tankPos[slot] = tankPos[lastSlot];
+		tankSlot[tankIdx[slot]] = slot;
+	}
+}
+
+// GridLevel::Insert : append a tank to a cell; false if the cell has no slack left
+bool GridLevel::Insert( int tank, int c, float2 position )
+{
+	if (cellStart[c] + cellCount[c] == cellStart[c + 1]) return false;
+	int slot = cellStart[c] + cellCount[c]++;
+	tankIdx[slot] = tank;
+	tankPos[slot] = position;
+	tankCell[tank] = c;
+	tankSlot[tank] = slot;
+	return true;
+}
+
+// Grid::SetCellSize : cell size of the finest level, in pixels, and the number of
+// levels; takes effect at the next Populate or Update, so until then the grid
+// stays consistent for queries and Remove
+void Grid::SetCellSize( int size, int levels )
+{
+	requested = make_int2( max( 1, size ), max( 1, levels ) );
+}
+
+// Grid::CellPos : cell coordinates of a position on the finest level, clamped to the grid
+int2 Grid::CellPos( float2 position ) const
+{
+	float2 p = position * invCellSize;
+	int x = p.x < 0 ? 0 : min( cells.x - 1, (int)p.x );
+	int y = p.y < 0 ? 0 : min( cells.y - 1, (int)p.y );
+	return make_int2( x, y );
+}
+
+// Grid::Prepare : (re)create the levels if the map or the cell size changed, and
+// find the cell of every tank on the finest level; coarser levels derive theirs
+void Grid::Prepare( const TankSystem& tanks )
+{
+	int2 size = MyApp::map.MapSize();
+	if (requested.x != cellSize || requested.y != levelCount || level.empty() || size.x != mapSize.x || size.y != mapSize.y)
+	{
+		mapSize = size;
+		cellSize = requested.x, levelCount = requested.y;
+		invCellSize = 1.0f / cellSize;
+		cells = make_int2( (mapSize.x + cellSize - 1) / cellSize, (mapSize.y + cellSize - 1) / cellSize );
+		level.resize( levelCount );
+		for (int l = 0; l < levelCount; l++) level[l].Init( cells, l );
 	}
-	return answer;
+	fineCell.resize( tanks.Count() );
+	for (int s = tanks.Count(), i = 0; i < s; i++) fineCell[i] = CellPos( tanks.pos[i] );
+}
+
+// Grid::Populate : rebuild all levels
+void Grid::Populate( const TankSystem& tanks )
+{
+	Prepare( tanks );
+	for (int l = 0; l < levelCount; l++) level[l].Populate( tanks, fineCell.data() );
+	migrations = 0;
+}
+
+// Grid::Update : incremental maintenance of all levels
+void Grid::Update( const TankSystem& tanks )
+{
+	Prepare( tanks );
+	migrations = 0;
+	for (int l = 0; l < levelCount; l++) migrations += level[l].Update( tanks, fineCell.data() );
+}
+
+// Grid::Remove : despawn, see GridLevel::Remove
+void Grid::Remove( int tank, int last )
+{
+	for (int l = 0; l < levelCount; l++) level[l].Remove( tank, last );
+}
+
+// Grid::FindEnemyInCone : first tank near position that is not in army and lies
+// within the cone ( origin, dir, minCos ); -1 if there is none
+int Grid::FindEnemyInCone( float2 position, float radius, int army, float2 origin, float2 dir, float minCos ) const
+{
+	const vector<int>& tankArmy = MyApp::tanks.army;
+	int found = -1;
+	VisitNearbyTanks( position, radius, -1, [&]( int other, float2 otherPos )
+	{
+		if (tankArmy[other] == army || dot( normalize( otherPos - origin ), dir ) <= minCos) return true;
+		found = other;
+		return false;
+	} );
+	return found;
 }
\ No newline at end of file
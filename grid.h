@@ -3,25 +3,90 @@
 namespace Tmpl8
 {
 
-#define GRIDSIZE		64
-#define CELLCAPACITY	256
+#define INCREMENTAL_GRID	// move only tanks that changed cell instead of rebuilding every frame
 
-struct ActorList 
-{ 
-	Tank* tank[CELLCAPACITY]; 
-	int count = 0; 
+// One resolution of the grid, in compressed sparse row layout: a counting sort
+// packs all tank indices, and a copy of their positions, into two arrays ordered
+// by cell. Cell c holds entries cellStart[c] .. cellStart[c] + cellCount[c] - 1;
+// the slots up to cellStart[c + 1] are slack, so Update can move a tank to
+// another cell without a rebuild.
+class GridLevel
+{
+public:
+	GridLevel() = default;
+	void Init( int2 cells, int shift );
+	void Populate( const TankSystem& tanks, const int2* fineCell );
+	int Update( const TankSystem& tanks, const int2* fineCell );
+	void Remove( int tank, int last );
+	int CellIndex( int2 fineCell ) const { return (fineCell.x >> shift) + (fineCell.y >> shift) * dims.x; }
+	int2 dims;					// cells in x and y
+	int shift = 0;				// a cell spans 2^shift cells of the finest level
+	vector<int> cellStart;		// dims.x * dims.y + 1 offsets into tankIdx / tankPos
+	vector<int> cellCount;		// tanks in each cell
+	vector<int> tankIdx;		// tank indices, sorted by cell
+	vector<float2> tankPos;		// tank positions, in the same order
+	vector<int> tankCell;		// cell of each tank, by tank index
+	vector<int> tankSlot;		// position of each tank in tankIdx / tankPos
+private:
+	void Unlink( int tank );
+	bool Insert( int tank, int cell, float2 position );
 };
 
+// Multi-resolution grid: level l has square cells of cellSize * 2^l pixels,
+// covering the current map whatever its size. A query scans only the cells that
+// its radius overlaps, on the finest level whose cells are at least as large as
+// the radius. Tanks outside the map are stored in the nearest border cell.
 class Grid
 {
 public:
 	Grid() = default;
-	void Clear();
-	void Populate( const vector<Actor*>& actors );
-	ActorList& FindNearbyTanks( Tank* aTank, float radius = 30 );
-	ActorList& FindNearbyTanks( float2 position, float radius = 30, Tank* tank = 0 );
-	ActorList cell[GRIDSIZE * GRIDSIZE];
-	ActorList answer; // we'll use this to return a list of nearby actors
+	void SetCellSize( int size, int levelCount );
+	void Populate( const TankSystem& tanks );
+	void Update( const TankSystem& tanks );
+	void Remove( int tank, int last );
+	// queries are const and keep no state, so any number of threads may query the
+	// grid at once; 'tank' (if not -1) is excluded from the results
+	template <class Visitor> bool VisitNearbyTanks( float2 position, float radius, int tank, Visitor visit ) const;
+	int FindEnemyInCone( float2 position, float radius, int army, float2 origin, float2 dir, float minCos ) const;
+	int2 CellPos( float2 position ) const;
+	vector<GridLevel> level;
+	int cellSize = 32, levelCount = 3;	// of the current levels; see SetCellSize
+	float invCellSize = 1.0f / 32;
+	int2 cells;							// size of the finest level, in cells
+	int2 mapSize;						// map size the levels were built for
+	int migrations = 0;					// cell changes in the last Update, over all levels
+private:
+	void Prepare( const TankSystem& tanks );
+	vector<int2> fineCell;				// cell of each tank on the finest level
+	int2 requested = make_int2( 32, 3 );	// cell size and level count for the next Prepare
 };
 
+// Grid::VisitNearbyTanks : call visit( index, position ) for every tank within
+// radius; stops as soon as visit returns false. Returns false if the query was
+// stopped early. Tanks are visited in a deterministic order.
+template <class Visitor> bool Grid::VisitNearbyTanks( float2 position, float radius, int tank, Visitor visit ) const
+{
+	int l = 0;
+	while (l < levelCount - 1 && (cellSize << l) < radius) l++;
+	const GridLevel& g = level[l];
+	int2 topLeft = CellPos( position - make_float2( radius ) ), bottomRight = CellPos( position + make_float2( radius ) );
+	topLeft.x >>= l, topLeft.y >>= l, bottomRight.x >>= l, bottomRight.y >>= l;
+	for (int x = topLeft.x; x <= bottomRight.x; x++)
+	{
+		for (int y = topLeft.y; y <= bottomRight.y; y++)
+		{
+			const int c = x + y * g.dims.x;
+			for (int i = g.cellStart[c], e = i + g.cellCount[c]; i < e; i++)
+			{
+				int other = g.tankIdx[i];
+				if (other == tank) continue;
+				float sqrDist = sqrLength( g.tankPos[i] - position );
+				if (sqrDist > radius * radius) continue;
+				if (!visit( other, g.tankPos[i] )) return false;
+			}
+		}
+	}
+	return true;
+}
+
 } // namespace Tmpl8
\ No newline at end of file
@@ -12,18 +12,82 @@ Map::Map()
 	Surface heightMap( "assets/heightmap.png" );
 	elevation = new int[width * height];
 	for (int i = 0; i < width * height; i++) elevation[i] = heightMap.pixels[i] & 255;
+	// build the mip chain
+	mip.push_back( bitmap );
+	for (int l = 1; l < MIP_LEVELS; l++) mip.push_back( new Surface( (mip[l - 1]->width + 1) >> 1, (mip[l - 1]->height + 1) >> 1 ) );
+	dirtyBlocks = make_int2( (width + 15) >> 4, (height + 15) >> 4 );
+	dirty.assign( dirtyBlocks.x * dirtyBlocks.y, 0 );
+	Touch( 0, 0, width - 1, height - 1 );
+	UpdateMips( make_int4( 0, 0, width - 1, height - 1 ), MIP_LEVELS - 1 );
+	covered.assign( ((SCRWIDTH + TILE - 1) / TILE) * ((SCRHEIGHT + TILE - 1) / TILE), 0 );
+	redrawRuns.reserve( covered.size() ), runStart.reserve( (SCRHEIGHT + TILE - 1) / TILE + 1 );
 	// set intial focus to centre of map
 	focus = make_int2( width >> 1, height >> 1 );
 	// all done; original maps will be deleted when leaving scope.
 }
 
+// Average4 : per channel average of four pixels, rounded
+static inline uint Average4( uint a, uint b, uint c, uint d )
+{
+	const uint rb = ((a & 0xff00ff) + (b & 0xff00ff) + (c & 0xff00ff) + (d & 0xff00ff) + 0x20002) >> 2;
+	const uint ag = (((a >> 8) & 0xff00ff) + ((b >> 8) & 0xff00ff) + ((c >> 8) & 0xff00ff) + ((d >> 8) & 0xff00ff) + 0x20002) >> 2;
+	return (rb & 0xff00ff) + ((ag & 0xff00ff) << 8);
+}
+
+// Average4x4 : Average4 for 4 adjacent output pixels, from 8 pixels of two rows;
+// averages rows, then pairs, so it may round up where Average4 rounds down
+static inline __m128i Average4x4( const uint* row0, const uint* row1 )
+{
+	const __m128 a = _mm_castsi128_ps( _mm_avg_epu8( _mm_loadu_si128( (const __m128i*)row0 ), _mm_loadu_si128( (const __m128i*)row1 ) ) );
+	const __m128 b = _mm_castsi128_ps( _mm_avg_epu8( _mm_loadu_si128( (const __m128i*)(row0 + 4) ), _mm_loadu_si128( (const __m128i*)(row1 + 4) ) ) );
+	const __m128i even = _mm_castps_si128( _mm_shuffle_ps( a, b, _MM_SHUFFLE( 2, 0, 2, 0 ) ) );
+	const __m128i odd = _mm_castps_si128( _mm_shuffle_ps( a, b, _MM_SHUFFLE( 3, 1, 3, 1 ) ) );
+	return _mm_avg_epu8( even, odd );
+}
+
+// Map::UpdateMips : bring levels 1 .. 'levels' of the touched blocks within a pixel
+// area up to date. Level l of a block depends only on level l - 1 of the same block,
+// so blocks can be processed in parallel.
+void Map::UpdateMips( int4 area, int levels )
+{
+	const int bx1 = max( 0, area.x >> 4 ), by1 = max( 0, area.y >> 4 );
+	const int bx2 = min( dirtyBlocks.x - 1, area.z >> 4 ), by2 = min( dirtyBlocks.y - 1, area.w >> 4 );
+	const uchar update = (uchar)((2 << levels) - 2); // bits 1 .. levels
+#pragma omp parallel for schedule(static)
+	for (int by = by1; by <= by2; by++) for (int bx = bx1; bx <= bx2; bx++)
+	{
+		uchar& d = dirty[bx + by * dirtyBlocks.x];
+		if (!(d & update)) continue;
+		d &= ~update;
+		for (int l = 1; l <= levels; l++)
+		{
+			const Surface& src = *mip[l - 1];
+			Surface& dst = *mip[l];
+			const int x1 = (bx * 16) >> l, x2 = min( dst.width, ((bx + 1) * 16) >> l );
+			const int y1 = (by * 16) >> l, y2 = min( dst.height, ((by + 1) * 16) >> l );
+			for (int y = y1; y < y2; y++)
+			{
+				// an odd-sized level repeats its last row and column
+				const uint* row0 = src.pixels + (y * 2) * src.width;
+				const uint* row1 = src.pixels + min( y * 2 + 1, src.height - 1 ) * src.width;
+				uint* out = dst.pixels + y * dst.width;
+				int x = x1;
+				for (; x + 4 <= x2 && x * 2 + 8 <= src.width; x += 4) _mm_storeu_si128( (__m128i*)(out + x), Average4x4( row0 + x * 2, row1 + x * 2 ) );
+				for (; x < x2; x++)
+				{
+					const int u0 = x * 2, u1 = min( u0 + 1, src.width - 1 );
+					out[x] = Average4( row0[u0], row0[u1], row1[u0], row1[u1] );
+				}
+			}
+		}
+	}
+}
+
 float inv100 = 1.0f / 100.0f;
 const float inv_SCRWIDTH = 1.0f / SCRWIDTH;
 const float inv_SCRHEIGHT = 1.0f / SCRHEIGHT;
 const float aspectRatio = (float)SCRHEIGHT / (float)SCRWIDTH;
 
-Surface last_frame( SCRWIDTH, SCRHEIGHT );
-
 void Map::UpdateView( Surface* target, float scale )
 {
 	// determine what map square to draw: centered at location 'focus', clamped to the edges of the map
@@ -49,46 +113,199 @@ void Map::UpdateView( Surface* target, float scale )
 	focus.y = (mapY1 + mapY2) >> 1;
 	view.x = mapX1, view.y = mapY1;
 	view.z = mapX2, view.w = mapY2;
+	redrawAll = true;
+}
+
+// DrawSpan : scalar resampling of 'count' screen pixels, starting at dst
+static void DrawSpan( const uint* mapLine, int width, uint* dst, uint x_fp, int dx, uint y_frac, int count )
+{
+	for (int x = 0; x < count; x++, x_fp += dx)
+	{
+		const uint mapPos = x_fp >> 14;
+		const uint p1 = mapLine[mapPos];
+		const uint p2 = mapLine[mapPos + 1];
+		const uint p3 = mapLine[mapPos + width];
+		const uint p4 = mapLine[mapPos + width + 1];
+		const uint x_frac = x_fp & 16383;
+		const uint w1 = ((16383 - x_frac) * (16383 - y_frac)) >> 20;
+		const uint w3 = ((16383 - x_frac) * y_frac) >> 20;
+		const uint w2 = (x_frac * (16383 - y_frac)) >> 20;
+		const uint w4 = 255 - (w1 + w2 + w3);
+		dst[x] = ScaleColor( p1, w1 ) + ScaleColor( p2, w2 ) + ScaleColor( p3, w3 ) + ScaleColor( p4, w4 );
+	}
+}
+
+// Pick8 : element idx (0..23) of the 24 pixels in a, b and c, for 8 lanes
+static TARGET_AVX2 __m256i Pick8( __m256i a, __m256i b, __m256i c, __m256i idx )
+{
+	__m256i r = _mm256_permutevar8x32_epi32( a, idx ); // uses the low 3 bits of idx
+	r = _mm256_blendv_epi8( r, _mm256_permutevar8x32_epi32( b, idx ), _mm256_cmpgt_epi32( idx, _mm256_set1_epi32( 7 ) ) );
+	return _mm256_blendv_epi8( r, _mm256_permutevar8x32_epi32( c, idx ), _mm256_cmpgt_epi32( idx, _mm256_set1_epi32( 15 ) ) );
+}
+
+// Scale8 : ScaleColor for 8 pixels, per channel in 16 bits; pixels 0, 1, 4, 5 go
+// to lo, 2, 3, 6, 7 to hi, which is the order _mm256_packus_epi16 undoes
+static TARGET_AVX2 void Scale8( __m256i p, __m256i w, __m256i& lo, __m256i& hi )
+{
+	const __m256i w16 = _mm256_or_si256( w, _mm256_slli_epi32( w, 16 ) );
+	const __m256i zero = _mm256_setzero_si256();
+	lo = _mm256_srli_epi16( _mm256_mullo_epi16( _mm256_unpacklo_epi8( p, zero ), _mm256_unpacklo_epi32( w16, w16 ) ), 8 );
+	hi = _mm256_srli_epi16( _mm256_mullo_epi16( _mm256_unpackhi_epi8( p, zero ), _mm256_unpackhi_epi32( w16, w16 ) ), 8 );
+}
+
+// DrawSpan8 : AVX2 version of DrawSpan, 8 pixels per iteration. Up to zoom 100 the
+// taps of 8 pixels lie within 24 consecutive map pixels, so they are picked from
+// three loads per map row instead of gathered. Each tap is scaled and shifted on
+// its own, as in ScaleColor, so the result is bit-identical to DrawSpan.
+static TARGET_AVX2 void DrawSpan8( const uint* mapLine, int width, uint* dst, uint x_fp, int dx, uint y_frac, int count )
+{
+	const __m256i step = _mm256_mullo_epi32( _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 ), _mm256_set1_epi32( dx ) );
+	const __m256i yf = _mm256_set1_epi32( y_frac ), iyf = _mm256_set1_epi32( 16383 - y_frac );
+	const __m256i frac = _mm256_set1_epi32( 16383 ), one = _mm256_set1_epi32( 1 );
+	int x = 0;
+	for (; x + 8 <= count; x += 8, x_fp += 8 * dx)
+	{
+		const uint base = x_fp >> 14, span = ((x_fp + 7 * dx) >> 14) - base + 2;
+		if (span > 24 || base + 24 > (uint)width) break; // wide steps or right edge: scalar
+		const __m256i fp = _mm256_add_epi32( _mm256_set1_epi32( x_fp ), step );
+		const __m256i idx = _mm256_sub_epi32( _mm256_srli_epi32( fp, 14 ), _mm256_set1_epi32( base ) );
+		const __m256i idx2 = _mm256_add_epi32( idx, one );
+		const __m256i* row0 = (const __m256i*)(mapLine + base), *row1 = (const __m256i*)(mapLine + base + width);
+		const __m256i a0 = _mm256_loadu_si256( row0 ), b0 = _mm256_loadu_si256( row0 + 1 ), c0 = _mm256_loadu_si256( row0 + 2 );
+		const __m256i a1 = _mm256_loadu_si256( row1 ), b1 = _mm256_loadu_si256( row1 + 1 ), c1 = _mm256_loadu_si256( row1 + 2 );
+		const __m256i p1 = Pick8( a0, b0, c0, idx ), p2 = Pick8( a0, b0, c0, idx2 );
+		const __m256i p3 = Pick8( a1, b1, c1, idx ), p4 = Pick8( a1, b1, c1, idx2 );
+		const __m256i xf = _mm256_and_si256( fp, frac ), ixf = _mm256_sub_epi32( frac, xf );
+		const __m256i w1 = _mm256_srli_epi32( _mm256_mullo_epi32( ixf, iyf ), 20 );
+		const __m256i w3 = _mm256_srli_epi32( _mm256_mullo_epi32( ixf, yf ), 20 );
+		const __m256i w2 = _mm256_srli_epi32( _mm256_mullo_epi32( xf, iyf ), 20 );
+		const __m256i w4 = _mm256_sub_epi32( _mm256_set1_epi32( 255 ), _mm256_add_epi32( _mm256_add_epi32( w1, w2 ), w3 ) );
+		__m256i lo[4], hi[4];
+		Scale8( p1, w1, lo[0], hi[0] ), Scale8( p2, w2, lo[1], hi[1] );
+		Scale8( p3, w3, lo[2], hi[2] ), Scale8( p4, w4, lo[3], hi[3] );
+		const __m256i sumLo = _mm256_add_epi16( _mm256_add_epi16( lo[0], lo[1] ), _mm256_add_epi16( lo[2], lo[3] ) );
+		const __m256i sumHi = _mm256_add_epi16( _mm256_add_epi16( hi[0], hi[1] ), _mm256_add_epi16( hi[2], hi[3] ) );
+		_mm256_storeu_si256( (__m256i*)(dst + x), _mm256_packus_epi16( sumLo, sumHi ) );
+	}
+	DrawSpan( mapLine, width, dst + x, x_fp, dx, y_frac, count - x );
 }
 
+// Map::Draw : resample the screen tiles that show a part of the map that changed
+// since the last Draw, or all tiles after UpdateView; the rest of the screen still
+// holds the previous frame
 void Map::Draw( Surface* target )
 {
-	int dx = ((view.z - view.x) * 16384) * inv_SCRWIDTH;
-	int dy = ((view.w - view.y) * 16384) * inv_SCRHEIGHT;
-	// draw pixels
-#pragma omp parallel for schedule(static)
+	const ScreenTransform transform = Transform();
+	int dx = transform.step.x, dy = transform.step.y;
+	const bool avx2 = simd && CPUCaps::HW_AVX2;
+	// pick the mip level: step through the map by 1 to 2 texels per screen pixel
+	int l = 0;
+#ifdef MIPMAPS
+	while (l < MIP_LEVELS - 1 && dx >= (32768 << l)) l++;
+#endif
+	// find the tiles to redraw: those that were drawn over, and those that show a
+	// dirty block; a tile reads the map from its first pixel to one texel beyond its
+	// last one, plus rounding, on the sampled level. Adjacent tiles on a tile row
+	// merge into one run, so a full redraw draws whole screen rows.
+	const int tilesX = (SCRWIDTH + TILE - 1) / TILE, tilesY = (SCRHEIGHT + TILE - 1) / TILE, margin = 2 << l;
+	redrawRuns.clear(), runStart.clear();
+	int tiles = 0;
+	for (int ty = 0; ty < tilesY; ty++)
+	{
+		runStart.push_back( (int)redrawRuns.size() );
+		const int sy1 = ty * TILE, sy2 = min( SCRHEIGHT, sy1 + TILE ) - 1;
+		const int by1 = max( 0, ((view.y << 14) + sy1 * dy) / 16384 - margin ) >> 4;
+		const int by2 = min( dirtyBlocks.y - 1, (((view.y << 14) + sy2 * dy) / 16384 + margin) >> 4 );
+		for (int tx = 0; tx < tilesX; tx++)
+		{
+			const int sx1 = tx * TILE, sx2 = min( SCRWIDTH, sx1 + TILE ) - 1;
+			const int bx1 = max( 0, ((view.x << 14) + sx1 * dx) / 16384 - margin ) >> 4;
+			const int bx2 = min( dirtyBlocks.x - 1, (((view.x << 14) + sx2 * dx) / 16384 + margin) >> 4 );
+			bool redraw = redrawAll || covered[tx + ty * tilesX];
+			for (int by = by1; by <= by2 && !redraw; by++) for (int bx = bx1; bx <= bx2 && !redraw; bx++)
+				redraw = dirty[bx + by * dirtyBlocks.x] & 1;
+			if (!redraw) continue;
+			tiles++;
+			if (redrawRuns.size() > (size_t)runStart.back() && redrawRuns.back().y == sx1) redrawRuns.back().y = sx2 + 1;
+			else redrawRuns.push_back( make_int2( sx1, sx2 + 1 ) );
+		}
+	}
+	runStart.push_back( (int)redrawRuns.size() );
+	redrawn = (float)tiles / (tilesX * tilesY);
+	// all changes within the view are on screen now; UpdateView redraws everything,
+	// so changes elsewhere need not be kept
+	for (int s = (int)dirty.size(), i = 0; i < s; i++) dirty[i] &= ~1;
+	memset( covered.data(), 0, covered.size() );
+	redrawAll = false;
+	if (l > 0) UpdateMips( view + make_int4( -16, -16, 16, 16 ), l );
+	const Surface& src = *mip[l];
+	dx >>= l, dy >>= l;
+	// draw pixels, per screen row; rows without runs are skipped, so their cost varies
+#pragma omp parallel for schedule(dynamic, 8)
 	for (int y = 0; y < SCRHEIGHT; y++)
 	{
-		uint y_fp = (view.y << 14) + y * dy;
-		uint* mapLine = bitmap->pixels + (y_fp >> 14) * width;
-		uint* dst = target->pixels + y * SCRWIDTH;
-		uint* lst = last_frame.pixels + y * SCRWIDTH;
+		const int ty = y / TILE;
+		const uint y_fp = ((view.y << 14) >> l) + y * dy;
+		const uint* mapLine = src.pixels + (y_fp >> 14) * src.width;
 		const uint y_frac = y_fp & 16383;
-		uint x_fp = view.x << 14;
-		for (int x = 0; x < SCRWIDTH; x++, x_fp += dx)
+		for (int r = runStart[ty]; r < runStart[ty + 1]; r++)
+		{
+			const int x1 = redrawRuns[r].x, count = redrawRuns[r].y - x1;
+			uint* dst = target->pixels + x1 + y * SCRWIDTH;
+			const uint x_fp = ((view.x << 14) >> l) + x1 * dx;
+			if (avx2) DrawSpan8( mapLine, src.width, dst, x_fp, dx, y_frac, count );
+			else DrawSpan( mapLine, src.width, dst, x_fp, dx, y_frac, count );
+		}
+	}
+}
+
+// Map::Benchmark : time both Draw paths across the zoom range: redrawing every tile,
+// half of them (a checkerboard, so no two adjacent tiles merge into a run), and none;
+// and check that both paths draw the same pixels
+void Map::Benchmark( Surface* target, int frames )
+{
+	const bool oldSimd = simd;
+	const int tilesX = (SCRWIDTH + TILE - 1) / TILE, tilesY = (SCRHEIGHT + TILE - 1) / TILE;
+	printf( "map draw, ms per frame       full redraw        half redrawn          unchanged\n" );
+	printf( "zoom                       scalar    avx2      scalar    avx2      scalar    avx2   same result\n" );
+	for (int zoom = 20; zoom <= 100; zoom += 10)
+	{
+		SetFocus( make_int2( width >> 1, height >> 1 ) );
+		UpdateView( target, (float)zoom );
+		float time[3][2] = {}; // [redraw: full, half, none][simd]
+		uint hash[2];
+		for (int path = 0; path < 2; path++) for (int redraw = 0; redraw < 3; redraw++)
 		{
-			const uint mapPos = x_fp >> 14;
-			const uint p1 = mapLine[mapPos];
-			const uint p2 = mapLine[mapPos + 1]; // mem
-			uint combined = p1 + p2; // int
-			const uint p3 = mapLine[mapPos + width]; // mem
-			combined += p3; //int
-			const uint p4 = mapLine[mapPos + width + 1]; // mem
-			combined += p4; //int
-			if (*lst != combined)
+			simd = path == 1;
+			Draw( target );
+			for (int i = 0; i < frames; i++)
 			{
-				const uint x_frac = x_fp & 16383; // integer
-				*lst = combined; // memory
-				const uint w1 = ((16383 - x_frac) * (16383 - y_frac)) >> 20; // integer
-				const uint w3 = ((16383 - x_frac) * y_frac) >> 20;
-				const uint w2 = (x_frac * (16383 - y_frac)) >> 20;
-				const uint w4 = 255 - (w1 + w2 + w3);
-				*dst = ScaleColor( p1, w1 ) + ScaleColor( p2, w2 ) + ScaleColor( p3, w3 ) + ScaleColor( p4, w4 ); // 
+				redrawAll = redraw == 0;
+				if (redraw == 1) for (int t = 0; t < tilesX * tilesY; t++) covered[t] = ((t % tilesX) + (t / tilesX)) & 1;
+				Timer timer;
+				Draw( target );
+				time[redraw][path] += timer.elapsed() * 1000 / frames;
 			}
-			dst++;
-			lst++;
+			if (redraw > 0) continue;
+			hash[path] = 2166136261u;
+			for (int i = 0; i < target->width * target->height; i++) hash[path] = (hash[path] ^ target->pixels[i]) * 16777619u;
 		}
+		printf( "%4i                     %7.3f %7.3f     %7.3f %7.3f     %7.3f %7.3f   %s\n", zoom,
+			time[0][0], time[0][1], time[1][0], time[1][1], time[2][0], time[2][1], hash[0] == hash[1] ? "yes" : "NO" );
 	}
+	simd = oldSimd;
+	redrawAll = true;
+}
+
+// Map::Transform : the map to screen transform used by Draw, for drawing over the map
+ScreenTransform Map::Transform() const
+{
+	ScreenTransform t;
+	t.origin = make_int2( view.x << 14, view.y << 14 );
+	t.step = make_int2( (int)(((view.z - view.x) * 16384) * inv_SCRWIDTH), (int)(((view.w - view.y) * 16384) * inv_SCRHEIGHT) );
+	t.offset = make_float2( (float)view.x, (float)view.y );
+	t.scale = make_float2( 16384.0f / t.step.x, 16384.0f / t.step.y );
+	return t;
 }
 
 int2 Map::ScreenToMap( int2 pos )
@@ -3,22 +3,70 @@
 namespace Tmpl8
 {
 
+#define MIPMAPS	// sample a mip level of the bitmap at wide zooms
+
+// The map to screen transform of Map::Draw: screen pixel (x, y) shows map position
+// (origin + (x, y) * step) / 16384
+struct ScreenTransform
+{
+	float2 ToScreen( float2 p ) const { return make_float2( (p.x - offset.x) * scale.x, (p.y - offset.y) * scale.y ); }
+	int2 origin, step;	// 14 bit fixed point
+	float2 offset;		// origin in map pixels
+	float2 scale;		// screen pixels per map pixel
+};
+
+// The terrain bitmap with a mip chain. Draw samples the level whose texels are
+// closest to, but not smaller than, a screen pixel; at wide zooms that reads a
+// quarter of the memory and does not alias. The mips are updated lazily, only for
+// the visible 16x16 blocks that were touched since the last update, and only up
+// to the level that is sampled.
 class Map
 {
 public:
+	enum { MIP_LEVELS = 5 }; // including the bitmap; level 4 has one texel per block
+	enum { TILE = 32 }; // Draw redraws the screen in tiles of TILE x TILE pixels
 	Map();
+	void UpdateMips( int4 area, int levels );
 	void UpdateView( Surface* target, float scale );
 	void Draw( Surface* target );
+	void Benchmark( Surface* target, int frames = 32 );
 	void SetFocus( int2 pos ) { focus = pos; }
 	void MoveFocus( int2 delta ) { focus += delta; }
 	int2 GetFocus() const { return focus; }
 	int2 MapSize() { return make_int2( width, height ); }
 	int2 ScreenToMap( int2 pos );
+	ScreenTransform Transform() const;
+	// anything drawn over the map on screen reports the (inclusive) screen rectangle,
+	// so the next Draw restores the tiles below it
+	void Cover( int x1, int y1, int x2, int y2 )
+	{
+		x1 = max( 0, x1 ) / TILE, y1 = max( 0, y1 ) / TILE;
+		x2 = min( SCRWIDTH - 1, x2 ) / TILE, y2 = min( SCRHEIGHT - 1, y2 ) / TILE;
+		for (int y = y1; y <= y2; y++) for (int x = x1; x <= x2; x++) covered[x + y * ((SCRWIDTH + TILE - 1) / TILE)] = 1;
+	}
+	// anything that writes to bitmap reports the (inclusive) pixel rectangle, so
+	// Draw can redraw the screen tiles that show it, and bring the mips up to date
+	static void Touch( int x1, int y1, int x2, int y2 )
+	{
+		x1 = max( 0, x1 ) >> 4, y1 = max( 0, y1 ) >> 4;
+		x2 = min( dirtyBlocks.x - 1, x2 >> 4 ), y2 = min( dirtyBlocks.y - 1, y2 >> 4 );
+		for (int y = y1; y <= y2; y++) for (int x = x1; x <= x2; x++) dirty[x + y * dirtyBlocks.x] = (2 << (MIP_LEVELS - 1)) - 1;
+	}
 	static inline Surface* bitmap = 0;
+	static inline vector<Surface*> mip;		// mip[0] is bitmap, each next level half the size
+	static inline vector<uchar> dirty;		// per 16x16 pixel block: bit 0 set if not on screen yet,
+											// bit l > 0 set if its level l is stale
+	static inline int2 dirtyBlocks;			// size of the block grid
 	int2 focus;
 	int* elevation;
 	int width, height;
 	int4 view; // visible portion of the map
+	bool simd = true; // Draw uses AVX2 if the CPU supports it
+	bool redrawAll = true; // next Draw redraws every tile, e.g. after UpdateView
+	float redrawn = 0; // fraction of the screen tiles redrawn by the last Draw
+	vector<int2> redrawRuns; // scratch for Draw: screen pixels [x, y) of a tile row
+	vector<int> runStart; // scratch for Draw: first run of each tile row
+	vector<uchar> covered; // per screen tile: drawn over since the last Draw
 };
 
 } // namespace Tmpl8
\ No newline at end of file
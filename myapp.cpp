@@ -1,5 +1,7 @@
 #include "precomp.h"
 
+#define TANK_PHASES 0 // bake 2^n x 2^n subpixel phases of the tank frames; 0 to sample bilinearly
+
 TheApp* CreateApp() { return new MyApp(); }
 
 // -----------------------------------------------------------
@@ -10,6 +12,11 @@ void MyApp::Init()
 	// load tank sprites
 	tank1 = new Sprite( "assets/tanks.png", make_int2( 128, 100 ), make_int2( 310, 360 ), 36, 256 );
 	tank2 = new Sprite( "assets/tanks.png", make_int2( 327, 99 ), make_int2( 515, 349 ), 36, 256 );
+#if TANK_PHASES > 0
+	tank1->BakePhases( TANK_PHASES ), tank2->BakePhases( TANK_PHASES );
+	printf( "pre-shifted tank frames: %.1f MB, %.1f MB without\n", 2 * tank1->PhaseBytes() / 1048576.0f,
+		2 * tank1->frameCount * sqr( tank1->frameSize ) * sizeof( uint ) / 1048576.0f );
+#endif
 	// load bush sprite for dust streams
 	bush[0] = new Sprite( "assets/bush1.png", make_int2( 2, 2 ), make_int2( 31, 31 ), 10, 256 );
 	bush[1] = new Sprite( "assets/bush2.png", make_int2( 2, 2 ), make_int2( 31, 31 ), 14, 256 );
@@ -18,41 +25,28 @@ void MyApp::Init()
 	bush[1]->ScaleAlpha( 64 );
 	bush[2]->ScaleAlpha( 128 );
 	// pointer
-	pointer = new SpriteInstance( new Sprite( "assets/pointer.png" ) );
-	// create armies
-	for (int y = 0; y < 16; y++) for (int x = 0; x < 16; x++) // main groups
-	{
-		Actor* army1Tank = new Tank( tank1, make_int2( 520 + x * 32, 2420 - y * 32 ), make_int2( 5000, -500 ), 0, 0 );
-		Actor* army2Tank = new Tank( tank2, make_int2( 3300 - x * 32, y * 32 + 700 ), make_int2( -1000, 4000 ), 10, 1 );
-		actorPool.push_back( army1Tank );
-		actorPool.push_back( army2Tank );
-	}
-	for (int y = 0; y < 12; y++) for (int x = 0; x < 12; x++) // backup
-	{
-		Actor* army1Tank = new Tank( tank1, make_int2( 40 + x * 32, 2620 - y * 32 ), make_int2( 5000, -500 ), 0, 0 );
-		Actor* army2Tank = new Tank( tank2, make_int2( 3900 - x * 32, y * 32 + 300 ), make_int2( -1000, 4000 ), 10, 1 );
-		actorPool.push_back( army1Tank );
-		actorPool.push_back( army2Tank );
-	}
-	for (int y = 0; y < 8; y++) for (int x = 0; x < 8; x++) // small forward groups
+	pointer = new Sprite( "assets/pointer.png" );
+	// create armies from the scenario: a file if one was given, the original battle otherwise
+	Scenario scenario = Scenario::Default();
+	if (scenarioFile && !scenario.Load( scenarioFile, map.MapSize() )) FatalError( "Could not load scenario %s", scenarioFile );
+	for (const Scenario::Block& b : scenario.blocks)
 	{
-		Actor* army1Tank = new Tank( tank1, make_int2( 1440 + x * 32, 2220 - y * 32 ), make_int2( 3500, -500 ), 0, 0 );
-		Actor* army2Tank = new Tank( tank2, make_int2( 2400 - x * 32, y * 32 + 900 ), make_int2( 1300, 4000 ), 128, 1 );
-		actorPool.push_back( army1Tank );
-		actorPool.push_back( army2Tank );
-	}
-	// load mountain peaks
-	Surface mountains( "assets/peaks.png" );
-	for (int y = 0; y < mountains.height; y++) for (int x = 0; x < mountains.width; x++)
-	{
-		uint p = mountains.pixels[x + y * mountains.width];
-		if ((p & 0xffff) == 0) peaks.push_back( make_float3( make_int3( x * 8, y * 8, (p >> 16) & 255 ) ) );
+		Sprite* sprite = scenario.armies[b.army].sprite == 0 ? tank1 : tank2;
+		for (int y = 0; y < b.size.y; y++) for (int x = 0; x < b.size.x; x++)
+			tanks.Add( sprite, b.origin + make_int2( x, y ) * b.step, b.target, b.frame, b.army );
 	}
+	printf( "scenario: %i tanks in %i blocks\n", tanks.Count(), (int)scenario.blocks.size() );
+	// bake the mountain peak forces into low-resolution fields
+	LoadPeaks();
+	mountainForce.Build( map.MapSize(), peaks, ForceField::PeakRepulsion );
+	sandDrift.Build( map.MapSize(), peaks, ForceField::PeakDrift, ForceField::SAND_CELL );
+	// terrain costs for the flow fields; the fields themselves are built when tanks need them
+	flowField.Init( map.MapSize(), peaks );
 	// add sandstorm
-	for (int i = 0; i < 7500; i += 4)
+	for (int i = 0; i < scenario.sand; i += 4)
 	{
-		int x[4] = { RandomUInt() % map.bitmap->width, RandomUInt() % map.bitmap->width, RandomUInt() % map.bitmap->width, RandomUInt() % map.bitmap->width };
-		int y[4] = { RandomUInt() % map.bitmap->height, RandomUInt() % map.bitmap->height, RandomUInt() % map.bitmap->height, RandomUInt() % map.bitmap->height };
+		int x[4] = { (int)(RandomUInt() % map.bitmap->width), (int)(RandomUInt() % map.bitmap->width), (int)(RandomUInt() % map.bitmap->width), (int)(RandomUInt() % map.bitmap->width) };
+		int y[4] = { (int)(RandomUInt() % map.bitmap->height), (int)(RandomUInt() % map.bitmap->height), (int)(RandomUInt() % map.bitmap->height), (int)(RandomUInt() % map.bitmap->height) };
 		uint d[4] = { (RandomUInt() & 15) - 8, (RandomUInt() & 15) - 8, (RandomUInt() & 15) - 8, (RandomUInt() & 15) - 8 };
 		Sprite* s[4] = { bush[(4 * i) % 3], bush[(4 * i + 1) % 3], bush[(4 * i + 2) % 3], bush[(4 * i + 3) % 3] };
 		float2 p[4] = { make_float2( x[0], y[0] ), make_float2( x[1], y[1] ), make_float2( x[2], y[2] ), make_float2( x[3], y[3] ) };
@@ -61,14 +55,25 @@ void MyApp::Init()
 	}
 	// place flags
 	Surface* flagPattern = new Surface( "assets/flag.png" );
-	VerletFlag* flag1 = new VerletFlag( make_int2( 3000, 848 ), flagPattern );
-	actorPool.push_back( flag1 );
-	VerletFlag* flag2 = new VerletFlag( make_int2( 1076, 1870 ), flagPattern );
-	actorPool.push_back( flag2 );
+	for (const int2& f : scenario.flags) flags.push_back( new VerletFlag( f, flagPattern ) );
 	// initialize map view
 	map.UpdateView( screen, zoom );
 }
 
+// -----------------------------------------------------------
+// Load the mountain peaks: one per black pixel of peaks.png
+// -----------------------------------------------------------
+void MyApp::LoadPeaks()
+{
+	Surface mountains( "assets/peaks.png" );
+	peaks.clear();
+	for (int y = 0; y < mountains.height; y++) for (int x = 0; x < mountains.width; x++)
+	{
+		uint p = mountains.pixels[x + y * mountains.width];
+		if ((p & 0xffff) == 0) peaks.push_back( make_float3( make_int3( x * 8, y * 8, (p >> 16) & 255 ) ) );
+	}
+}
+
 // -----------------------------------------------------------
 // Advanced zooming
 // -----------------------------------------------------------
@@ -108,40 +113,62 @@ void MyApp::HandleInput()
 }
 
 // -----------------------------------------------------------
-// Main application tick function - Executed once per frame
+// Per-type actor passes; T is a final class, so calls are direct
 // -----------------------------------------------------------
-void MyApp::Tick( float deltaTime )
+template <class T> static void TickAll( vector<T*>& actors )
 {
-	Timer t;
-	// draw the map
-	map.Draw( screen );
-	// rebuild actor grid
-	grid.Clear();
-	grid.Populate( actorPool );
-	// update and render actors
-	pointer->Remove();
-	for (int s = (int)sand.size(), i = s - 1; i >= 0; i--) sand[i]->Remove();
-	for (int s = (int)actorPool.size(), i = s - 1; i >= 0; i--) actorPool[i]->Remove();
-	for (int s = (int)sand.size(), i = 0; i < s; i++) sand[i]->Tick();
-	for (int i = 0; i < (int)actorPool.size(); i++) if (!actorPool[i]->Tick())
+	for (int i = 0; i < (int)actors.size(); i++) if (!actors[i]->Tick())
 	{
 		// actor got deleted, replace by last in list
-		Actor* lastActor = actorPool.back();
-		Actor* toDelete = actorPool[i];
-		actorPool.pop_back();
-		if (lastActor != toDelete) actorPool[i] = lastActor;
+		T* toDelete = actors[i];
+		actors[i] = actors.back();
+		actors.pop_back();
 		delete toDelete;
 		i--;
 	}
+}
+template <class T> static void DrawAll( vector<T*>& actors )
+{
+	for (int s = (int)actors.size(), i = 0; i < s; i++) actors[i]->Draw();
+}
+
+// -----------------------------------------------------------
+// Main application tick function - Executed once per frame
+// -----------------------------------------------------------
+void MyApp::Tick( float deltaTime )
+{
+	Timer t;
+	// update actor grid
+#ifdef INCREMENTAL_GRID
+	grid.Update( tanks );
+#else
+	grid.Populate( tanks );
+#endif
+	// update actors
+	for (int s = (int)sand.size(), i = 0; i < s; i++) sand[i]->Tick();
+	tanks.Tick(); // queues bullets and particle explosions
+	events.Flush(); // bullets fired, tanks destroyed
+	Bullet::Collide( bullets );
+	TickAll( flags ), TickAll( bullets );
+	events.Flush(); // tanks hit, bullets expired
+	TickAll( spriteExplosions ), TickAll( particleExplosions );
+	// destroyed tanks leave only after all actors used this frame's grid
+	tanks.Compact();
 	coolDown++;
-	for (int s = (int)actorPool.size(), i = 0; i < s; i++) actorPool[i]->Draw();
+	// draw the map, then the actors over it
+	map.Draw( screen );
+	tanks.Draw();
+	DrawAll( flags ), DrawAll( bullets ), DrawAll( spriteExplosions ), DrawAll( particleExplosions );
 	for (int s = (int)sand.size(), i = 0; i < s; i++) sand[i]->Draw();
 	int2 cursorPos = map.ScreenToMap( mousePos );
-	pointer->Draw( map.bitmap, make_float2( cursorPos ), 0 );
+	compositor.DrawSprite( pointer, make_float2( cursorPos ), 0 );
+	compositor.Render( screen, map );
 	// handle mouse
 	HandleInput();
 	// report frame time
 	static float frameTimeAvg = 10.0f; // estimate
 	frameTimeAvg = 0.95f * frameTimeAvg + 0.05f * t.elapsed() * 1000;
-	printf( "frame time: %5.2fms\n", frameTimeAvg );
+	printf( "frame time: %5.2fms, map tiles redrawn: %3.0f%%, grid migrations: %i, lod tanks %i/%i/%i in %.2f/%.2f/%.2fms\n",
+		frameTimeAvg, map.redrawn * 100, grid.migrations, tanks.tierCount[0], tanks.tierCount[1], tanks.tierCount[2],
+		tanks.tierTime[0], tanks.tierTime[1], tanks.tierTime[2] );
 }
\ No newline at end of file
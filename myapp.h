@@ -11,6 +11,7 @@ public:
 	void HandleInput();
 	void Tick( float deltaTime );
 	void Shutdown() { /* implement if you want to do something on exit */ }
+	static void LoadPeaks();
 	// input handling
 	void MouseUp( int button ) { mouseDown = false; }
 	void MouseDown( int button ) { mouseDown = true; }
@@ -24,14 +25,24 @@ public:
 	bool mouseDown = false;						// keeping track of mouse button status
 	Sprite* tank1, *tank2;						// tank sprites
 	Sprite* bush[3];							// bush sprite
-	SpriteInstance* pointer;					// mouse pointer sprite
+	Sprite* pointer;							// mouse pointer sprite
 	// static data, for global access
 	static inline Map map;						// the map
-	static inline vector<Actor*> actorPool;		// actor pool
+	static inline TankSystem tanks;				// all tanks, stored as arrays
+	static inline vector<VerletFlag*> flags;	// one container per actor type, each with
+	static inline vector<Bullet*> bullets;		// its own tick, draw and remove pass
+	static inline vector<SpriteExplosion*> spriteExplosions;
+	static inline vector<ParticleExplosion*> particleExplosions;
+	static inline Events events;				// hits and spawns, applied at sync points
+	static inline Compositor compositor;		// actors drawn over the map, on screen
 	static inline vector<float3> peaks;			// mountain peaks to evade
+	static inline ForceField mountainForce;		// peak repulsion for tanks, precomputed
+	static inline ForceField sandDrift;			// peak drift for sand, precomputed
+	static inline FlowField flowField;			// paths to tank targets, one field per target
 	static inline vector<Particle*> sand;		// sand particles
 	static inline Grid grid;					// actor grid for faster range queries
 	static inline int coolDown = 0;				// used to prevent simultaneous firing
+	static inline const char* scenarioFile = 0;	// scenario to load; the original battle if null
 };
 
 } // namespace Tmpl8
\ No newline at end of file
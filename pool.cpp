@@ -0,0 +1,60 @@
+#include "precomp.h"
+#include <atomic>
+#include <new>
+
+// global allocation counter; operator new is replaced for the whole program
+static std::atomic<size_t> allocations( 0 );
+size_t Tmpl8::HeapAllocations() { return allocations.load(); }
+
+void* operator new( size_t size )
+{
+	allocations++;
+	if (void* p = malloc( size ? size : 1 )) return p;
+	throw std::bad_alloc();
+}
+void* operator new[]( size_t size ) { return operator new( size ); }
+void operator delete( void* p ) noexcept { free( p ); }
+void operator delete[]( void* p ) noexcept { free( p ); }
+void operator delete( void* p, size_t ) noexcept { free( p ); }
+void operator delete[]( void* p, size_t ) noexcept { free( p ); }
+
+// over-aligned types (alignas above 16, e.g. Events::Queue) use these; they are
+// counted as well, and must be freed with the matching aligned free
+#ifdef _MSC_VER
+static void* AlignedAlloc( size_t size, size_t align ) { return _aligned_malloc( size ? size : 1, align ); }
+static void AlignedFree( void* p ) { _aligned_free( p ); }
+#else
+static void* AlignedAlloc( size_t size, size_t align ) { return aligned_alloc( align, ((size ? size : 1) + align - 1) & ~(align - 1) ); }
+static void AlignedFree( void* p ) { free( p ); }
+#endif
+void* operator new( size_t size, std::align_val_t align )
+{
+	allocations++;
+	if (void* p = AlignedAlloc( size, (size_t)align )) return p;
+	throw std::bad_alloc();
+}
+void* operator new[]( size_t size, std::align_val_t align ) { return operator new( size, align ); }
+void operator delete( void* p, std::align_val_t ) noexcept { AlignedFree( p ); }
+void operator delete[]( void* p, std::align_val_t ) noexcept { AlignedFree( p ); }
+void operator delete( void* p, size_t, std::align_val_t ) noexcept { AlignedFree( p ); }
+void operator delete[]( void* p, size_t, std::align_val_t ) noexcept { AlignedFree( p ); }
+
+// BufferPool::Alloc : reuse a freed buffer of the same size, or allocate a new one
+void* BufferPool::Alloc( size_t bytes )
+{
+	for (FreeList& list : lists) if (list.bytes == bytes && !list.buffers.empty())
+	{
+		void* buffer = list.buffers.back();
+		list.buffers.pop_back();
+		return buffer;
+	}
+	return ::operator new( bytes );
+}
+
+// BufferPool::Free : keep the buffer for the next Alloc of this size
+void BufferPool::Free( void* buffer, size_t bytes )
+{
+	if (!buffer) return;
+	for (FreeList& list : lists) if (list.bytes == bytes) { list.buffers.push_back( buffer ); return; }
+	lists.push_back( FreeList{ bytes, vector<void*>( 1, buffer ) } );
+}
\ No newline at end of file
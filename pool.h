@@ -0,0 +1,48 @@
+#pragma once
+
+namespace Tmpl8
+{
+
+// Number of heap allocations (operator new, including the aligned forms) since program
+// start; benchmarks compare it before and after a run of frames to check for
+// steady-state allocations.
+size_t HeapAllocations();
+
+// Fixed-size slots for objects of type T, recycled through a free list and never
+// returned to the heap. Classes use it from their operator new / delete.
+template <class T> class Pool
+{
+public:
+	void* Alloc()
+	{
+		if (freeSlots.empty()) Grow();
+		void* slot = freeSlots.back();
+		freeSlots.pop_back();
+		return slot;
+	}
+	void Free( void* slot ) { if (slot) freeSlots.push_back( slot ); }
+private:
+	void Grow()
+	{
+		enum { SLOTS = 64 };
+		const size_t slotSize = (sizeof( T ) + 15) & ~(size_t)15;
+		char* block = (char*)::operator new( slotSize * SLOTS );
+		for (int i = SLOTS - 1; i >= 0; i--) freeSlots.push_back( block + i * slotSize );
+	}
+	vector<void*> freeSlots;
+};
+
+// Recycled buffers of arbitrary size, for per-instance data that outlives a frame,
+// like explosion particles. A buffer must be freed with the size it was allocated
+// with.
+class BufferPool
+{
+public:
+	static void* Alloc( size_t bytes );
+	static void Free( void* buffer, size_t bytes );
+private:
+	struct FreeList { size_t bytes; vector<void*> buffers; };
+	static inline vector<FreeList> lists;
+};
+
+} // namespace Tmpl8
\ No newline at end of file
@@ -0,0 +1,168 @@
+#include "precomp.h"
+
+static const uint SCENARIO_MAGIC = 0x534b4e54, SCENARIO_VERSION = 2; // 'TNKS'; 2: no struct padding
+static const int64_t MAX_TANKS = 1 << 24, MAX_SAND = 1 << 24; // far beyond what the game can run
+static const int64_t MARGIN = 4096; // how far outside the map positions and targets may lie
+static const int64_t ARMY_INTS = 1, BLOCK_INTS = 10, FLAG_INTS = 2; // fields per record
+
+// InBounds : p lies within MARGIN of the map
+static bool InBounds( int64_t x, int64_t y, int2 mapSize )
+{
+	return x >= -MARGIN && y >= -MARGIN && x <= mapSize.x + MARGIN && y <= mapSize.y + MARGIN;
+}
+
+// Put : append v to a file image as a little-endian int32
+static void Put( vector<uchar>& out, int v )
+{
+	for (int i = 0; i < 4; i++) out.push_back( (uchar)((uint)v >> (8 * i)) );
+}
+
+// Get : read the little-endian int32 at p, and advance p
+static int Get( const uchar*& p )
+{
+	const uint v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint)p[3] << 24);
+	p += 4;
+	return (int)v;
+}
+
+// Scenario::Load : read a scenario file for a map of mapSize pixels; false if it is
+// missing or malformed
+bool Scenario::Load( const char* file, int2 mapSize )
+{
+	FILE* f = fopen( file, "rb" );
+	if (!f) return false;
+	uchar headerBytes[24];
+	const uchar* p = headerBytes;
+	bool ok = fread( headerBytes, sizeof( headerBytes ), 1, f ) == 1;
+	uint header[6] = {};
+	for (int i = 0; i < 6 && ok; i++) header[i] = (uint)Get( p );
+	ok = ok && header[0] == SCENARIO_MAGIC && header[1] == SCENARIO_VERSION;
+	// the records must fill the rest of the file, so corrupt counts cannot
+	// trigger huge allocations
+	const long start = ftell( f );
+	ok = ok && fseek( f, 0, SEEK_END ) == 0;
+	const int64_t remaining = ok ? (int64_t)ftell( f ) - start : 0;
+	const int64_t bytes = 4 * ((int64_t)header[2] * ARMY_INTS + (int64_t)header[3] * BLOCK_INTS + (int64_t)header[4] * FLAG_INTS);
+	ok = ok && fseek( f, start, SEEK_SET ) == 0 && header[5] <= MAX_SAND && header[2] <= MAX_ARMIES && bytes == remaining;
+	vector<uchar> records( ok ? (size_t)bytes : 0 );
+	ok = ok && fread( records.data(), 1, records.size(), f ) == records.size();
+	fclose( f );
+	if (ok)
+	{
+		armies.resize( header[2] ), blocks.resize( header[3] ), flags.resize( header[4] ), sand = (int)header[5];
+		p = records.data();
+		for (Army& a : armies) a.sprite = Get( p );
+		for (Block& b : blocks)
+		{
+			b.army = Get( p ), b.origin.x = Get( p ), b.origin.y = Get( p ), b.step.x = Get( p ), b.step.y = Get( p );
+			b.size.x = Get( p ), b.size.y = Get( p ), b.target.x = Get( p ), b.target.y = Get( p ), b.frame = Get( p );
+		}
+		for (int2& flag : flags) flag.x = Get( p ), flag.y = Get( p );
+	}
+	// reject references to armies that do not exist, degenerate blocks, frames
+	// outside the 256 tank directions, blocks or targets far off the map, and more
+	// tanks than TankCount can sum
+	int64_t tanks = 0;
+	for (int s = (int)blocks.size(), i = 0; i < s && ok; i++)
+	{
+		const Block& b = blocks[i];
+		ok = b.army >= 0 && b.army < (int)armies.size() && b.size.x >= 0 && b.size.y >= 0 && b.frame >= 0 && b.frame < 256;
+		tanks += (int64_t)b.size.x * b.size.y;
+		ok = ok && tanks <= MAX_TANKS && InBounds( b.target.x, b.target.y, mapSize );
+		// the last tank; the block spans the rectangle from origin to it
+		if (ok && b.size.x > 0 && b.size.y > 0) ok = InBounds( b.origin.x, b.origin.y, mapSize ) &&
+			InBounds( b.origin.x + (int64_t)(b.size.x - 1) * b.step.x, b.origin.y + (int64_t)(b.size.y - 1) * b.step.y, mapSize );
+	}
+	for (int s = (int)flags.size(), i = 0; i < s && ok; i++) ok = InBounds( flags[i].x, flags[i].y, mapSize );
+	for (int s = (int)armies.size(), i = 0; i < s && ok; i++) ok = armies[i].sprite == 0 || armies[i].sprite == 1;
+	return ok;
+}
+
+// Scenario::Save : write the scenario in the format read by Load
+bool Scenario::Save( const char* file ) const
+{
+	vector<uchar> out;
+	const uint header[6] = { SCENARIO_MAGIC, SCENARIO_VERSION, (uint)armies.size(), (uint)blocks.size(), (uint)flags.size(), (uint)sand };
+	for (uint h : header) Put( out, (int)h );
+	for (const Army& a : armies) Put( out, a.sprite );
+	for (const Block& b : blocks)
+	{
+		Put( out, b.army ), Put( out, b.origin.x ), Put( out, b.origin.y ), Put( out, b.step.x ), Put( out, b.step.y );
+		Put( out, b.size.x ), Put( out, b.size.y ), Put( out, b.target.x ), Put( out, b.target.y ), Put( out, b.frame );
+	}
+	for (const int2& flag : flags) Put( out, flag.x ), Put( out, flag.y );
+	FILE* f = fopen( file, "wb" );
+	if (!f) return false;
+	const bool ok = fwrite( out.data(), 1, out.size(), f ) == out.size();
+	return (fclose( f ) == 0) && ok;
+}
+
+// Scenario::TankCount : number of tanks spawned by all blocks
+int Scenario::TankCount() const
+{
+	int count = 0;
+	for (int s = (int)blocks.size(), i = 0; i < s; i++) count += blocks[i].size.x * blocks[i].size.y;
+	return count;
+}
+
+// Scenario::Default : the original battle
+Scenario Scenario::Default()
+{
+	Scenario s;
+	s.armies = { { 0 }, { 1 } };
+	s.blocks = {
+		{ 0, make_int2( 520, 2420 ), make_int2( 32, -32 ), make_int2( 16, 16 ), make_int2( 5000, -500 ), 0 }, // main groups
+		{ 1, make_int2( 3300, 700 ), make_int2( -32, 32 ), make_int2( 16, 16 ), make_int2( -1000, 4000 ), 10 },
+		{ 0, make_int2( 40, 2620 ), make_int2( 32, -32 ), make_int2( 12, 12 ), make_int2( 5000, -500 ), 0 }, // backup
+		{ 1, make_int2( 3900, 300 ), make_int2( -32, 32 ), make_int2( 12, 12 ), make_int2( -1000, 4000 ), 10 },
+		{ 0, make_int2( 1440, 2220 ), make_int2( 32, -32 ), make_int2( 8, 8 ), make_int2( 3500, -500 ), 0 }, // small forward groups
+		{ 1, make_int2( 2400, 900 ), make_int2( -32, 32 ), make_int2( 8, 8 ), make_int2( 1300, 4000 ), 128 }
+	};
+	s.flags = { make_int2( 3000, 848 ), make_int2( 1076, 1870 ) };
+	s.sand = 7500;
+	return s;
+}
+
+// Scenario::Generate : large battle for stress testing. Each army fills its own
+// half of the map (bottom-left and top-right, as in the original battle) with a
+// lattice of 16x16 blocks; spacing shrinks with the tank count, down to 2 pixels.
+// Targets are drawn from a few points per army so the number of flow fields stays
+// small.
+Scenario Scenario::Generate( int tankCount, int2 mapSize, uint seed )
+{
+	Scenario s;
+	s.armies = { { 0 }, { 1 } };
+	s.flags = Default().flags;
+	s.sand = 7500;
+	const int2 targets[2][3] = {
+		{ make_int2( 5000, -500 ), make_int2( 3500, -500 ), make_int2( mapSize.x + 500, mapSize.y / 4 ) },
+		{ make_int2( -1000, 4000 ), make_int2( 1300, 4000 ), make_int2( -500, mapSize.y * 3 / 4 ) }
+	};
+	for (int army = 0; army < 2; army++)
+	{
+		const int count = (tankCount + 1 - army) / 2; // army 0 gets the odd tank
+		if (count == 0) continue;
+		// region: half the map, minus a margin
+		const int regionW = mapSize.x / 2 - 80, regionH = mapSize.y / 2 - 80;
+		const int spacing = clamp( (int)sqrtf( (float)regionW * regionH / count ), 2, 32 );
+		const int columns = max( 1, regionW / spacing );
+		const int rows = (count + columns - 1) / columns;
+		// army 0 starts bottom-left and grows up and right; army 1 mirrors that
+		const int2 corner = army == 0 ? make_int2( 40, mapSize.y - 40 ) : make_int2( mapSize.x - 40, 40 );
+		const int2 step = army == 0 ? make_int2( spacing, -spacing ) : make_int2( -spacing, spacing );
+		auto addBlock = [&]( int x, int y, int w, int h )
+		{
+			Block b = { army, corner + make_int2( x, y ) * step, step, make_int2( w, h ), targets[army][RandomUInt( seed ) % 3], army == 0 ? 0 : 10 };
+			s.blocks.push_back( b );
+		};
+		int left = count;
+		for (int by = 0; by < rows && left > 0; by += 16) for (int bx = 0; bx < columns && left > 0; bx += 16)
+		{
+			// the last block gets the whole rows that remain, plus a partial row
+			const int w = min( 16, columns - bx ), h = min( 16, rows - by ), full = min( h, left / w );
+			if (full > 0) addBlock( bx, by, w, full ), left -= w * full;
+			if (full < h && left > 0) addBlock( bx, by + full, left, 1 ), left = 0;
+		}
+	}
+	return s;
+}
\ No newline at end of file
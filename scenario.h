@@ -0,0 +1,30 @@
+#pragma once
+
+namespace Tmpl8
+{
+
+// Scenario: the starting state of a battle. Armies are placed in rectangular
+// spawn blocks, so even a million tanks take only a few thousand records.
+// Stored as a compact binary file of little-endian int32 fields, without padding:
+//   header:  'TNKS', version, army count, block count, flag count, sand count
+//   armies:  sprite index (0 = tank1, 1 = tank2)
+//   blocks:  army, origin, step, size (columns, rows), target, initial frame
+//   flags:   pole position
+class Scenario
+{
+public:
+	enum { MAX_ARMIES = 32 }; // TankSystem keeps a bit per army in 32-bit masks
+	struct Army { int sprite; };
+	struct Block { int army; int2 origin, step, size, target; int frame; };
+	bool Load( const char* file, int2 mapSize );
+	bool Save( const char* file ) const;
+	int TankCount() const;
+	static Scenario Default();
+	static Scenario Generate( int tankCount, int2 mapSize, uint seed = 0x12345678 );
+	vector<Army> armies;
+	vector<Block> blocks;	// tanks spawn at origin + (x, y) * step, row by row
+	vector<int2> flags;
+	int sand = 0;			// sand particles
+};
+
+} // namespace Tmpl8
\ No newline at end of file
@@ -53,6 +53,7 @@ Sprite::Sprite( const char* fileName )
 		// OPT: Introduce ternary operator '?'
 		pixels[i] = pixels[i] == 0xff00ff ? 0 : pixels[i] | 0xff000000;
 	}
+	BuildSpans();
 }
 
 Sprite::Sprite( const char* fileName, int frames )
@@ -66,6 +67,7 @@ Sprite::Sprite( const char* fileName, int frames )
 	int frameSizeSqrCount = frameSize * frameSize * frameCount;
 	pixels = new uint[frameSizeSqrCount];
 	memcpy( pixels, original.pixels, frameSizeSqrCount * 4 );
+	BuildSpans();
 }
 
 Sprite::Sprite( const char* fileName, int2 topLeft, int2 bottomRight, int size, int frames )
@@ -162,6 +164,7 @@ Sprite::Sprite( const char* fileName, int2 topLeft, int2 bottomRight, int size,
 	}
 	frameCount = frames;
 	frameSize = size;
+	BuildSpans();
 }
 
 void Sprite::ScaleAlpha( uint scale )
@@ -184,230 +187,358 @@ void Sprite::ScaleAlpha( uint scale )
 			int a = ((pixels[i] >> 24) * scale) >> 8;
 			pixels[i] = (pixels[i] & 0xffffff) + (a << 24);
 		}
+	// visible texels may have become transparent, and baked phases are stale
+	BuildSpans();
+	if (phases) BakePhases( phaseBits );
 }
 
-void SpriteInstance::Draw( Surface* target, float2 pos, int frame )
+// Sprite::BuildSpans : for each frame and row pair (v, v + 1), the runs of u where
+// the bilinear footprint (u, v) .. (u + 1, v + 1) has a visible texel. Footprints
+// without visible texels would blend with alpha 0, which leaves the pixel as it is,
+// so Draw skips them. Opaque footprints are still blended: the Bilerp weights are
+// truncated and sum to less than 256, so their samples rarely reach alpha 255.
+void Sprite::BuildSpans()
 {
-	// save the area of target that we are about to overwrite
-	// OPT: Precalculation
-	int frameSize = sprite->frameSize;
-	int frameSizeTimes4 = frameSize * 4;
-	// OPT: Ternary operator
-	backup = backup ? backup : new uint[sqr( frameSize + 1 )];
-	int2 intPos = make_int2( pos );
-	// OPT: Bit-shifts
-	int x1 = intPos.x - (frameSize >> 1), x2 = x1 + frameSize;
-	int y1 = intPos.y - (frameSize >> 1), y2 = y1 + frameSize;
-	if (x1 < 0 || y1 < 0 || x2 >= target->width || y2 >= target->height)
+	const int stride = frameSize * frameCount;
+	spans.clear(), spanStart.clear();
+	for (int f = 0; f < frameCount; f++) for (int v = 0; v < frameSize - 1; v++)
 	{
-		// out of range; skip
-		lastTarget = 0;
-		return;
-	}
-	// OPT: Precalculations
-	uint* dst_start = target->pixels + x1 + y1 * target->width;
-#ifdef UNROLLING
-	if ((frameSize & (frameSize - 1)) == 0)
-		for (int v = 0; v < frameSize; v += 2)
-		{
-			uint* new_backup = backup + v * frameSize;
-			uint* new_dst_start = dst_start + v * target->width;
-			memcpy( new_backup, new_dst_start, frameSizeTimes4 );
-			memcpy( new_backup + frameSize, new_dst_start + target->width, frameSizeTimes4 );
-		}
-	else
-	#endif
-		for (int v = 0; v < frameSize; v++)
+		spanStart.push_back( (int)spans.size() );
+		const uint* line = pixels + f * frameSize + v * stride;
+		bool visible = false; // the current run
+		for (int u = 0; u < frameSize - 1; u++)
 		{
-			memcpy( backup + v * frameSize, dst_start + v * target->width, frameSizeTimes4 );
-		}
-	lastPos = make_int2( x1, y1 );
-	lastTarget = target;
-	// calculate bilinear weights - these are constant in this case.
-	uint frac_x = (int)(255.0f * (pos.x - floorf( pos.x )));
-	uint frac_y = (int)(255.0f * (pos.y - floorf( pos.y )));
-	// Precalculations
-	uint frac_x_inv = (255 - frac_x), frac_y_inv = (255 - frac_y);
-	uint w0 = (frac_x * frac_y) >> 8;
-	uint w1 = (frac_x_inv * frac_y) >> 8;
-	uint w2 = (frac_x * frac_y_inv) >> 8;
-	uint w3 = (frac_x_inv * frac_y_inv) >> 8;
-	// draw the sprite frame
-	uint stride = sprite->frameCount * frameSize;
-	// Precalculations
-	uint* src_start = sprite->pixels + frame * frameSize;
-	int frameSizeMinusOne = frameSize - 1;
-#ifdef UNROLLING
-	if ((frameSizeMinusOne & (frameSizeMinusOne - 1)) == 0)
-		for (int v = 0; v < frameSizeMinusOne; v += 2)
-		{
-			uint* new_dst_start = dst_start + v * target->width;
-			uint* new_src_start = src_start + v * stride;
-			uint* dst = new_dst_start;
-			uint* src = new_src_start;
-			for (int u = 0; u < frameSizeMinusOne; u++, src++, dst++)
-			{
-				uint pix = ScaleColor( src[0], w0 )
-					+ ScaleColor( src[1], w1 )
-					+ ScaleColor( src[stride], w2 )
-					+ ScaleColor( src[stride + 1], w3 );
-				uint alpha = pix >> 24;
-				*dst = ScaleColor( pix, alpha ) + ScaleColor( *dst, 255 - alpha );
-				u++, src++, dst++;
-				pix = ScaleColor( src[0], w0 )
-					+ ScaleColor( src[1], w1 )
-					+ ScaleColor( src[stride], w2 )
-					+ ScaleColor( src[stride + 1], w3 );
-				alpha = pix >> 24;
-				*dst = ScaleColor( pix, alpha ) + ScaleColor( *dst, 255 - alpha );
-			}
-			dst = new_dst_start + target->width;
-			src = new_src_start + stride;
-			for (int u = 0; u < frameSizeMinusOne; u++, src++, dst++)
-			{
-				uint pix = ScaleColor( src[0], w0 )
-					+ ScaleColor( src[1], w1 )
-					+ ScaleColor( src[stride], w2 )
-					+ ScaleColor( src[stride + 1], w3 );
-				uint alpha = pix >> 24;
-				*dst = ScaleColor( pix, alpha ) + ScaleColor( *dst, 255 - alpha );
-				u++, src++, dst++;
-				pix = ScaleColor( src[0], w0 )
-					+ ScaleColor( src[1], w1 )
-					+ ScaleColor( src[stride], w2 )
-					+ ScaleColor( src[stride + 1], w3 );
-				alpha = pix >> 24;
-				*dst = ScaleColor( pix, alpha ) + ScaleColor( *dst, 255 - alpha );
-			}
-		}
-	else
-	#endif
-		for (int v = 0; v < frameSizeMinusOne; v++)
-		{
-			uint* dst = dst_start + v * target->width;
-			uint* src = src_start + v * stride;
-			for (int u = 0; u < frameSizeMinusOne; u++, src++, dst++)
-			{
-				uint pix = ScaleColor( src[0], w0 )
-					+ ScaleColor( src[1], w1 )
-					+ ScaleColor( src[stride], w2 )
-					+ ScaleColor( src[stride + 1], w3 );
-				uint alpha = pix >> 24;
-				*dst = ScaleColor( pix, alpha ) + ScaleColor( *dst, 255 - alpha );
-			}
+			const bool t = ((line[u] | line[u + 1] | line[u + stride] | line[u + stride + 1]) >> 24) != 0;
+			if (t == visible) continue;
+			if (visible) spans.back().last = u;
+			else spans.push_back( { (short)u, (short)(frameSize - 1) } );
+			visible = t;
 		}
+	}
+	spanStart.push_back( (int)spans.size() );
 }
 
-void SpriteInstance::DrawAdditive( Surface* target, float2 pos, int frame )
+// CeilDiv : a / b rounded up, for b > 0
+static inline int CeilDiv( int a, int b )
 {
-	// save the area of target that we are about to overwrite
-	// OPT: Precalculations
-	int frameSize = sprite->frameSize, frameCount = sprite->frameCount;
-	int frameSizeTimesCount = frameSize * frameCount, frameSizeTimes4 = frameSize * 4;
-	int frameTimesFrameSize = frame * frameSize;
-	// OPT: Ternary operator
-	backup = backup ? backup : new uint[frameSize * frameSize];
-	int2 intPos = make_int2( pos );
-	// OPT: Bit-shifts
-	int x1 = intPos.x - (frameSize >> 1), x2 = x1 + frameSize;
-	int y1 = intPos.y - (frameSize >> 1), y2 = y1 + frameSize;
-	if (x1 < 0 || y1 < 0 || x2 >= target->width || y2 >= target->height)
+	return a >= 0 ? (a + b - 1) / b : -(-a / b);
+}
+
+// Sprite::ScreenRect : the screen pixels [x, z) x [y, w) that sample the frame at map
+// position pos: those whose four taps lie inside the frame, within clip
+int4 Sprite::ScreenRect( const ScreenTransform& view, float2 pos, int4 clip ) const
+{
+	const int ox = (int)((pos.x - frameSize * 0.5f) * 16384), oy = (int)((pos.y - frameSize * 0.5f) * 16384);
+	const int extent = (frameSize - 1) << 14;
+	return make_int4(
+		max( clip.x, CeilDiv( ox - view.origin.x, view.step.x ) ), max( clip.y, CeilDiv( oy - view.origin.y, view.step.y ) ),
+		min( clip.z, CeilDiv( ox + extent - view.origin.x, view.step.x ) ),
+		min( clip.w, CeilDiv( oy + extent - view.origin.y, view.step.y ) ) );
+}
+
+// Bilerp : bilinear sample between p[0], p[1], p[stride] and p[stride + 1], with
+// 8-bit fractions; the weights sum to at most 256, so channels do not overflow
+static inline uint Bilerp( const uint* p, int stride, uint fu, uint fv )
+{
+	const uint w00 = ((256 - fu) * (256 - fv)) >> 8, w10 = (fu * (256 - fv)) >> 8;
+	const uint w01 = ((256 - fu) * fv) >> 8, w11 = (fu * fv) >> 8;
+	return ScaleColor( p[0], w00 ) + ScaleColor( p[1], w10 ) + ScaleColor( p[stride], w01 ) + ScaleColor( p[stride + 1], w11 );
+}
+
+// AlphaBlend : c over d; alpha 0..255 maps to 0..256, so that alpha 0 keeps d and
+// alpha 255 replaces it
+static inline uint AlphaBlend( uint c, uint d )
+{
+	const uint a = (c >> 24) + (c >> 31);
+	return ScaleColor( c, a ) + ScaleColor( d, 256 - a );
+}
+
+// BlendLine : scalar blitter; resample 'count' pixels of a frame row pair at frame
+// position u, u + du, .. (14 bit fixed point) and blend them over dst
+static void BlendLine( const uint* line, int stride, uint* dst, int u, int du, uint fv, int count )
+{
+	for (int x = 0; x < count; x++, u += du) dst[x] = AlphaBlend( Bilerp( line + (u >> 14), stride, (u >> 6) & 255, fv ), dst[x] );
+}
+
+// The SIMD blitters do the same math per channel in 16-bit lanes: ScaleColor with a
+// weight of at most 256 is (channel * weight) >> 8 for each channel, and the
+// products fit in 16 bits, so the output is bit-exact with BlendLine.
+
+// Bilerp4 : Bilerp for 4 pixels, as 16-bit channels of pixels 0, 1 (lo) and 2, 3 (hi)
+static inline void Bilerp4( const __m128i p[4], __m128i fu, __m128i fv, __m128i& lo, __m128i& hi )
+{
+	const __m128i c256 = _mm_set1_epi32( 256 ), zero = _mm_setzero_si128();
+	const __m128i ifu = _mm_sub_epi32( c256, fu ), ifv = _mm_sub_epi32( c256, fv );
+	const __m128i w[4] = {
+		_mm_srli_epi32( _mm_mullo_epi32( ifu, ifv ), 8 ), _mm_srli_epi32( _mm_mullo_epi32( fu, ifv ), 8 ),
+		_mm_srli_epi32( _mm_mullo_epi32( ifu, fv ), 8 ), _mm_srli_epi32( _mm_mullo_epi32( fu, fv ), 8 )
+	};
+	lo = hi = zero;
+	for (int i = 0; i < 4; i++)
 	{
-		// out of range; skip
-		lastTarget = 0;
-		return;
+		const __m128i w16 = _mm_or_si128( w[i], _mm_slli_epi32( w[i], 16 ) );
+		lo = _mm_add_epi16( lo, _mm_srli_epi16( _mm_mullo_epi16( _mm_unpacklo_epi8( p[i], zero ), _mm_unpacklo_epi32( w16, w16 ) ), 8 ) );
+		hi = _mm_add_epi16( hi, _mm_srli_epi16( _mm_mullo_epi16( _mm_unpackhi_epi8( p[i], zero ), _mm_unpackhi_epi32( w16, w16 ) ), 8 ) );
 	}
-	// OPT: Precalculate a part of the dst pointer
-	uint* dst_start = target->pixels + x1 + y1 * target->width;
-#ifdef UNROLLING
-	if ((frameSize & (frameSize - 1)) == 0)
-		for (int v = 0; v < frameSize; v += 2)
+}
+
+// Blend4 : AlphaBlend of 16-bit channels c over d
+static inline __m128i Blend4( __m128i c, __m128i d )
+{
+	const __m128i alpha = _mm_shufflehi_epi16( _mm_shufflelo_epi16( c, 0xff ), 0xff );
+	const __m128i a = _mm_add_epi16( alpha, _mm_srli_epi16( alpha, 7 ) ), ia = _mm_sub_epi16( _mm_set1_epi16( 256 ), a );
+	return _mm_add_epi16( _mm_srli_epi16( _mm_mullo_epi16( c, a ), 8 ), _mm_srli_epi16( _mm_mullo_epi16( d, ia ), 8 ) );
+}
+
+// BlendLine4 : SSE4.1 blitter, 4 pixels per iteration; the taps are loaded one by one
+static void BlendLine4( const uint* line, int stride, uint* dst, int u, int du, uint fv, int count )
+{
+	const __m128i zero = _mm_setzero_si128(), fv4 = _mm_set1_epi32( fv );
+	const __m128i step = _mm_setr_epi32( 0, du, 2 * du, 3 * du ), mask = _mm_set1_epi32( 255 );
+	int x = 0;
+	for (; x + 4 <= count; x += 4, u += 4 * du)
+	{
+		const uint* t[4] = { line + (u >> 14), line + ((u + du) >> 14), line + ((u + 2 * du) >> 14), line + ((u + 3 * du) >> 14) };
+		const __m128i p[4] = {
+			_mm_setr_epi32( t[0][0], t[1][0], t[2][0], t[3][0] ), _mm_setr_epi32( t[0][1], t[1][1], t[2][1], t[3][1] ),
+			_mm_setr_epi32( t[0][stride], t[1][stride], t[2][stride], t[3][stride] ),
+			_mm_setr_epi32( t[0][stride + 1], t[1][stride + 1], t[2][stride + 1], t[3][stride + 1] )
+		};
+		const __m128i fu = _mm_and_si128( _mm_srli_epi32( _mm_add_epi32( _mm_set1_epi32( u ), step ), 6 ), mask );
+		__m128i lo, hi;
+		Bilerp4( p, fu, fv4, lo, hi );
+		const __m128i d = _mm_loadu_si128( (__m128i*)(dst + x) );
+		lo = Blend4( lo, _mm_unpacklo_epi8( d, zero ) ), hi = Blend4( hi, _mm_unpackhi_epi8( d, zero ) );
+		_mm_storeu_si128( (__m128i*)(dst + x), _mm_packus_epi16( lo, hi ) );
+	}
+	BlendLine( line, stride, dst + x, u, du, fv, count - x );
+}
+
+// BlendLine8 : AVX2 blitter, 8 pixels per iteration, with gathered taps; same lane
+// layout as Bilerp4 and Blend4, per 128-bit half
+static TARGET_AVX2 void BlendLine8( const uint* line, int stride, uint* dst, int u, int du, uint fv, int count )
+{
+	const __m256i zero = _mm256_setzero_si256(), c256 = _mm256_set1_epi32( 256 ), mask = _mm256_set1_epi32( 255 );
+	const __m256i step = _mm256_mullo_epi32( _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 ), _mm256_set1_epi32( du ) );
+	const __m256i fv8 = _mm256_set1_epi32( fv ), ifv8 = _mm256_sub_epi32( c256, fv8 );
+	const int* l0 = (const int*)line, * l1 = (const int*)(line + stride);
+	int x = 0;
+	for (; x + 8 <= count; x += 8, u += 8 * du)
+	{
+		const __m256i uu = _mm256_add_epi32( _mm256_set1_epi32( u ), step );
+		const __m256i idx = _mm256_srli_epi32( uu, 14 ), idx1 = _mm256_add_epi32( idx, _mm256_set1_epi32( 1 ) );
+		const __m256i p[4] = {
+			_mm256_i32gather_epi32( l0, idx, 4 ), _mm256_i32gather_epi32( l0, idx1, 4 ),
+			_mm256_i32gather_epi32( l1, idx, 4 ), _mm256_i32gather_epi32( l1, idx1, 4 )
+		};
+		const __m256i fu = _mm256_and_si256( _mm256_srli_epi32( uu, 6 ), mask ), ifu = _mm256_sub_epi32( c256, fu );
+		const __m256i w[4] = {
+			_mm256_srli_epi32( _mm256_mullo_epi32( ifu, ifv8 ), 8 ), _mm256_srli_epi32( _mm256_mullo_epi32( fu, ifv8 ), 8 ),
+			_mm256_srli_epi32( _mm256_mullo_epi32( ifu, fv8 ), 8 ), _mm256_srli_epi32( _mm256_mullo_epi32( fu, fv8 ), 8 )
+		};
+		__m256i lo = zero, hi = zero;
+		for (int i = 0; i < 4; i++)
 		{
-			uint* new_backup = backup + v * frameSize;
-			uint* new_dst_start = dst_start + v * target->width;
-			memcpy( new_backup, new_dst_start, frameSizeTimes4 );
-			memcpy( new_backup + frameSize, new_dst_start + target->width, frameSizeTimes4 );
+			const __m256i w16 = _mm256_or_si256( w[i], _mm256_slli_epi32( w[i], 16 ) );
+			lo = _mm256_add_epi16( lo, _mm256_srli_epi16( _mm256_mullo_epi16( _mm256_unpacklo_epi8( p[i], zero ), _mm256_unpacklo_epi32( w16, w16 ) ), 8 ) );
+			hi = _mm256_add_epi16( hi, _mm256_srli_epi16( _mm256_mullo_epi16( _mm256_unpackhi_epi8( p[i], zero ), _mm256_unpackhi_epi32( w16, w16 ) ), 8 ) );
 		}
-	else
-	#endif
-		for (int v = 0; v < frameSize; v++)
+		const __m256i d = _mm256_loadu_si256( (__m256i*)(dst + x) );
+		__m256i c[2] = { lo, hi }, dd[2] = { _mm256_unpacklo_epi8( d, zero ), _mm256_unpackhi_epi8( d, zero ) };
+		for (int i = 0; i < 2; i++)
 		{
-			memcpy( backup + v * frameSize, dst_start + v * target->width, frameSizeTimes4 );
+			const __m256i alpha = _mm256_shufflehi_epi16( _mm256_shufflelo_epi16( c[i], 0xff ), 0xff );
+			const __m256i a = _mm256_add_epi16( alpha, _mm256_srli_epi16( alpha, 7 ) ), ia = _mm256_sub_epi16( _mm256_set1_epi16( 256 ), a );
+			c[i] = _mm256_add_epi16( _mm256_srli_epi16( _mm256_mullo_epi16( c[i], a ), 8 ), _mm256_srli_epi16( _mm256_mullo_epi16( dd[i], ia ), 8 ) );
 		}
-	// draw the sprite frame
-#ifdef UNROLLING
-	if ((frameSize & (frameSize - 1)) == 0)
-		for (int v = 0; v < frameSize; v += 2)
+		_mm256_storeu_si256( (__m256i*)(dst + x), _mm256_packus_epi16( c[0], c[1] ) );
+	}
+	BlendLine( line, stride, dst + x, u, du, fv, count - x );
+}
+
+// PhaseLine : blitter for pre-shifted frames; one texel per pixel, at index u >> shift
+// of a row that holds all horizontal phases of each texel side by side
+static void PhaseLine( const uint* row, uint* dst, int u, int du, int shift, int count )
+{
+	for (int x = 0; x < count; x++, u += du) dst[x] = AlphaBlend( row[u >> shift], dst[x] );
+}
+
+// PhaseLine4 : SSE4.1 version of PhaseLine
+static void PhaseLine4( const uint* row, uint* dst, int u, int du, int shift, int count )
+{
+	const __m128i zero = _mm_setzero_si128();
+	int x = 0;
+	for (; x + 4 <= count; x += 4, u += 4 * du)
+	{
+		const __m128i c = _mm_setr_epi32( row[u >> shift], row[(u + du) >> shift], row[(u + 2 * du) >> shift], row[(u + 3 * du) >> shift] );
+		const __m128i d = _mm_loadu_si128( (__m128i*)(dst + x) );
+		const __m128i lo = Blend4( _mm_unpacklo_epi8( c, zero ), _mm_unpacklo_epi8( d, zero ) );
+		const __m128i hi = Blend4( _mm_unpackhi_epi8( c, zero ), _mm_unpackhi_epi8( d, zero ) );
+		_mm_storeu_si128( (__m128i*)(dst + x), _mm_packus_epi16( lo, hi ) );
+	}
+	PhaseLine( row, dst + x, u, du, shift, count - x );
+}
+
+// PhaseLine8 : AVX2 version of PhaseLine
+static TARGET_AVX2 void PhaseLine8( const uint* row, uint* dst, int u, int du, int shift, int count )
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i step = _mm256_mullo_epi32( _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 ), _mm256_set1_epi32( du ) );
+	const __m128i count128 = _mm_cvtsi32_si128( shift );
+	int x = 0;
+	for (; x + 8 <= count; x += 8, u += 8 * du)
+	{
+		const __m256i idx = _mm256_srl_epi32( _mm256_add_epi32( _mm256_set1_epi32( u ), step ), count128 );
+		const __m256i c = _mm256_i32gather_epi32( (const int*)row, idx, 4 );
+		const __m256i d = _mm256_loadu_si256( (__m256i*)(dst + x) );
+		__m256i cc[2] = { _mm256_unpacklo_epi8( c, zero ), _mm256_unpackhi_epi8( c, zero ) };
+		const __m256i dd[2] = { _mm256_unpacklo_epi8( d, zero ), _mm256_unpackhi_epi8( d, zero ) };
+		for (int i = 0; i < 2; i++)
 		{
-			// OPT: Precalculations
-			uint* dst_start_new = dst_start + v * target->width;
-			int index_start = frameTimesFrameSize + v * frameSizeTimesCount;
-			for (int u = 0; u < frameSize; u += 2)
-			{
-				uint* dst = dst_start + u;
-				int new_start = index_start + u;
-				uint pix = sprite->pixels[new_start];
-				*dst = AddBlend( *dst, pix );
-				dst++;
-				pix = sprite->pixels[new_start + 1];
-				*dst = AddBlend( *dst, pix );
-			}
-			dst_start_new = dst_start_new + target->width;
-			index_start = index_start + frameSizeTimesCount;
-			for (int u = 0; u < frameSize; u += 2)
-			{
-				uint* dst = dst_start + u;
-				int new_start = index_start + u;
-				uint pix = sprite->pixels[new_start];
-				*dst = AddBlend( *dst, pix );
-				dst++;
-				pix = sprite->pixels[new_start + 1];
-				*dst = AddBlend( *dst, pix );
-			}
+			const __m256i alpha = _mm256_shufflehi_epi16( _mm256_shufflelo_epi16( cc[i], 0xff ), 0xff );
+			const __m256i a = _mm256_add_epi16( alpha, _mm256_srli_epi16( alpha, 7 ) ), ia = _mm256_sub_epi16( _mm256_set1_epi16( 256 ), a );
+			cc[i] = _mm256_add_epi16( _mm256_srli_epi16( _mm256_mullo_epi16( cc[i], a ), 8 ), _mm256_srli_epi16( _mm256_mullo_epi16( dd[i], ia ), 8 ) );
 		}
-	else
-	#endif
-		for (int v = 0; v < frameSize; v++)
+		_mm256_storeu_si256( (__m256i*)(dst + x), _mm256_packus_epi16( cc[0], cc[1] ) );
+	}
+	PhaseLine( row, dst + x, u, du, shift, count - x );
+}
+
+// Sprite::BakePhases : store each frame resampled at 2^bits x 2^bits subpixel offsets,
+// so that Draw reads one pre-filtered texel per pixel instead of four. The sampling
+// position is rounded down to the nearest phase; where it falls on a phase, the
+// result equals the bilinear path. Baking again replaces the previous phases.
+void Sprite::BakePhases( int bits )
+{
+	const int n = 1 << bits, stride = frameSize * frameCount;
+	FREE64( phases );
+	phaseBits = bits;
+	phases = (uint*)MALLOC64( PhaseBytes() );
+	memset( phases, 0, PhaseBytes() );
+	for (int f = 0; f < frameCount; f++) for (int v = 0; v < frameSize - 1; v++) for (int pv = 0; pv < n; pv++)
+	{
+		// row (f, v, pv): texel u, phase pu at u * n + pu
+		uint* row = phases + ((size_t)(f * frameSize + v) * n + pv) * frameSize * n;
+		const uint* line = pixels + f * frameSize + v * stride;
+		for (int u = 0; u < frameSize - 1; u++) for (int pu = 0; pu < n; pu++)
+			row[u * n + pu] = Bilerp( line + u, stride, (pu << 8) >> bits, (pv << 8) >> bits );
+	}
+}
+
+// Sprite::Draw : alpha blend a frame over the screen pixels in clip, centred at map
+// position pos. Per screen row, only the spans of the sampled row pair are drawn.
+void Sprite::Draw( Surface* target, const ScreenTransform& view, float2 pos, int frame, int4 clip ) const
+{
+	const int4 r = ScreenRect( view, pos, clip );
+	const int ox = (int)((pos.x - frameSize * 0.5f) * 16384), oy = (int)((pos.y - frameSize * 0.5f) * 16384);
+	const int stride = frameSize * frameCount, du = view.step.x;
+	const uint* src = pixels + frame * frameSize;
+	const Blitter path = blitter != BLIT_AUTO ? blitter : !simd ? BLIT_SCALAR :
+		CPUCaps::HW_AVX2 ? BLIT_AVX2 : CPUCaps::HW_SSE41 ? BLIT_SSE41 : BLIT_SCALAR;
+	const bool avx2 = path == BLIT_AVX2, sse41 = path == BLIT_SSE41;
+	void (*blend)(const uint*, int, uint*, int, int, uint, int) = avx2 ? BlendLine8 : sse41 ? BlendLine4 : BlendLine;
+	void (*blendPhases)(const uint*, uint*, int, int, int, int) = avx2 ? PhaseLine8 : sse41 ? PhaseLine4 : PhaseLine;
+	const int n = 1 << phaseBits, shift = 14 - phaseBits;
+	// frame position of the first pixel of each row, in 14 bit fixed point
+	const int u0 = view.origin.x + r.x * du - ox;
+	for (int y = r.y; y < r.w; y++)
+	{
+		const int v = view.origin.y + y * view.step.y - oy;
+		const int row = frame * (frameSize - 1) + (v >> 14);
+		for (int i = spanStart[row]; i < spanStart[row + 1]; i++)
 		{
-			// OPT: Precalculations
-			uint* dst_start_new = dst_start + v * target->width;
-			int index_start = frameTimesFrameSize + v * frameSizeTimesCount;
-			for (int u = 0; u < frameSize; u++)
-			{
-				uint* dst = dst_start + u;
-				uint pix = sprite->pixels[index_start + u];
-				*dst = AddBlend( *dst, pix );
-			}
+			// the screen pixels whose u lies in the span
+			const int x1 = r.x + max( 0, CeilDiv( (spans[i].first << 14) - u0, du ) );
+			const int x2 = r.x + min( r.z - r.x, CeilDiv( (spans[i].last << 14) - u0, du ) );
+			if (x1 >= x2) continue;
+			uint* dst = target->pixels + x1 + y * target->width;
+			const int u = u0 + (x1 - r.x) * du;
+			if (phases) blendPhases( phases + ((size_t)(frame * frameSize + (v >> 14)) * n + ((v >> shift) & (n - 1))) * frameSize * n,
+				dst, u, du, shift, x2 - x1 );
+			else blend( src + (v >> 14) * stride, stride, dst, u, du, (v >> 6) & 255, x2 - x1 );
 		}
-	// remember where we drew so it can be removed later
-	lastPos = make_int2( x1, y1 );
-	lastTarget = target;
+	}
 }
 
-void SpriteInstance::Remove()
+// Sprite::DrawAdditive : as Draw, but adds the frame to the screen, for explosions
+void Sprite::DrawAdditive( Surface* target, const ScreenTransform& view, float2 pos, int frame, int4 clip ) const
 {
-	// use the stored pixels to restore the rectangle affected by the sprite.
-	// note: sprites must be removed in reverse order to guarantee correct removal.
-	if (lastTarget)
+	const int4 r = ScreenRect( view, pos, clip );
+	const int ox = (int)((pos.x - frameSize * 0.5f) * 16384), oy = (int)((pos.y - frameSize * 0.5f) * 16384);
+	const int stride = frameSize * frameCount;
+	const uint* src = pixels + frame * frameSize;
+	for (int y = r.y; y < r.w; y++)
 	{
-		// OPT: Precalculations
-		int frameSize = sprite->frameSize;
-		int frameSizeTimes4 = frameSize * 4;
-		uint* dst_start = lastTarget->pixels + lastPos.x + lastPos.y * lastTarget->width;
-	#ifdef UNROLLING
-		if ((frameSize & (frameSize - 1)) == 0)
-			for (int v = 0; v < frameSize; v += 2)
-			{
-				uint* new_start = dst_start + v * lastTarget->width;
-				uint* new_backup = backup + v * frameSize;
-				memcpy( new_start, new_backup, frameSizeTimes4 );
-				memcpy( new_start + lastTarget->width, new_backup + frameSize, frameSizeTimes4 );
-			}
-		else
-		#endif
-			for (int v = 0; v < frameSize; v++)
-			{
-				memcpy( dst_start + v * lastTarget->width, backup + v * frameSize, frameSizeTimes4 );
-			}
+		const int v = view.origin.y + y * view.step.y - oy;
+		const uint* line = src + (v >> 14) * stride;
+		const uint fv = (v >> 6) & 255;
+		uint* dst = target->pixels + y * target->width;
+		for (int x = r.x, u = view.origin.x + x * view.step.x - ox; x < r.z; x++, u += view.step.x)
+			dst[x] = AddBlend( dst[x], Bilerp( line + (u >> 14), stride, (u >> 6) & 255, fv ) );
+	}
+}
+
+// DrawRect : reference for Draw; blends the whole screen rect of the frame, without
+// span tables or SIMD
+static void DrawRect( const Sprite& sprite, Surface* target, const ScreenTransform& view, float2 pos, int frame, int4 clip )
+{
+	const int4 r = sprite.ScreenRect( view, pos, clip );
+	const int ox = (int)((pos.x - sprite.frameSize * 0.5f) * 16384), oy = (int)((pos.y - sprite.frameSize * 0.5f) * 16384);
+	const int stride = sprite.frameSize * sprite.frameCount;
+	for (int y = r.y; y < r.w; y++)
+	{
+		const int v = view.origin.y + y * view.step.y - oy;
+		BlendLine( sprite.pixels + frame * sprite.frameSize + (v >> 14) * stride, stride, target->pixels + r.x + y * target->width,
+			view.origin.x + r.x * view.step.x - ox, view.step.x, (v >> 6) & 255, r.z - r.x );
+	}
+}
+
+// Sprite::Benchmark : time the blitters on tanks spread over the view, across the
+// zoom range, and check that all of them produce the same pixels as blending the
+// full rect of each tank
+void Sprite::Benchmark( Surface* target, Map& map )
+{
+	enum { TANKS = 20000 };
+	Sprite tank( "assets/tanks.png", make_int2( 128, 100 ), make_int2( 310, 360 ), 36, 256 );
+	const Blitter oldBlitter = blitter;
+	const int4 screen = make_int4( 0, 0, target->width, target->height );
+	Sprite shifted( "assets/tanks.png", make_int2( 128, 100 ), make_int2( 310, 360 ), 36, 256 );
+	shifted.BakePhases( 2 );
+	printf( "pre-shifted 4x4 phases: %.1f MB per tank sprite, %.1f MB without\n", shifted.PhaseBytes() / 1048576.0f,
+		(size_t)tank.frameCount * sqr( tank.frameSize ) * sizeof( uint ) / 1048576.0f );
+	printf( "sprite draw, ms per %i tanks     scalar   sse4.1     avx2   same result   pre-shifted\n", TANKS );
+	for (int zoom = 20; zoom <= 100; zoom += 40)
+	{
+		map.SetFocus( make_int2( map.width >> 1, map.height >> 1 ) );
+		map.UpdateView( target, (float)zoom );
+		const ScreenTransform view = map.Transform();
+		vector<float2> pos( TANKS );
+		vector<int> frame( TANKS );
+		for (int i = 0; i < TANKS; i++)
+		{
+			pos[i] = make_float2( map.view.x + RandomFloat() * (map.view.z - map.view.x), map.view.y + RandomFloat() * (map.view.w - map.view.y) );
+			frame[i] = RandomUInt() & 255;
+		}
+		// path 3: the full-rect reference
+		float time[4];
+		uint hash[4];
+		for (int path = 3; path >= 0; path--)
+		{
+			if ((path == 1 && !CPUCaps::HW_SSE41) || (path == 2 && !CPUCaps::HW_AVX2)) { time[path] = 0, hash[path] = hash[3]; continue; }
+			if (path < 3) blitter = (Blitter)(BLIT_SCALAR + path);
+			for (int i = 0; i < target->width * target->height; i++) target->pixels[i] = i * 2654435761u;
+			Timer timer;
+			if (path == 3) for (int i = 0; i < TANKS; i++) DrawRect( tank, target, view, pos[i], frame[i], screen );
+			else for (int i = 0; i < TANKS; i++) tank.Draw( target, view, pos[i], frame[i], screen );
+			time[path] = timer.elapsed() * 1000;
+			hash[path] = 2166136261u;
+			for (int i = 0; i < target->width * target->height; i++) hash[path] = (hash[path] ^ target->pixels[i]) * 16777619u;
+		}
+		blitter = oldBlitter;
+		Timer timer;
+		for (int i = 0; i < TANKS; i++) shifted.Draw( target, view, pos[i], frame[i], screen );
+		const float shiftedTime = timer.elapsed() * 1000;
+		printf( "zoom %3i                        %8.2f %8.2f %8.2f   %s %15.2f\n", zoom, time[0], time[1], time[2],
+			hash[0] == hash[3] && hash[1] == hash[3] && hash[2] == hash[3] ? "yes" : "NO ", shiftedTime );
 	}
 }
\ No newline at end of file
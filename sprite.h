@@ -3,29 +3,37 @@
 namespace Tmpl8
 {
 
+// A sprite, with its frames side by side in one bitmap. Sprites are drawn over the
+// map on screen: each screen pixel samples the frame bilinearly at its own map
+// position, so sprites scale with the zoom.
 class Sprite
 {
 public:
 	Sprite( const char* fileName );
 	Sprite( const char* fileName, int2 topLeft, int2 bottomRight, int size, int frames );
 	Sprite( const char* fileName, int frames );
+	Sprite( const Sprite& ) = delete;
+	~Sprite() { delete[] pixels; FREE64( phases ); }
+	Sprite& operator=( const Sprite& ) = delete;
 	void ScaleAlpha( uint scale );
+	void BakePhases( int bits );
+	size_t PhaseBytes() const { return (size_t)frameCount * sqr( frameSize << phaseBits ) * sizeof( uint ); }
+	void Draw( Surface* target, const ScreenTransform& view, float2 pos, int frame, int4 clip ) const;
+	void DrawAdditive( Surface* target, const ScreenTransform& view, float2 pos, int frame, int4 clip ) const;
+	int4 ScreenRect( const ScreenTransform& view, float2 pos, int4 clip ) const;
+	static void Benchmark( Surface* target, Map& map );
 	uint* pixels;
 	int frameCount, frameSize;
-};
-
-class SpriteInstance
-{
-public:
-	SpriteInstance() = default;
-	SpriteInstance( Sprite* s ) : sprite( s ) {}
-	void Draw( Surface* target, float2 pos, int frame );
-	void DrawAdditive( Surface* target, float2 pos, int frame );
-	void Remove();
-	Sprite* sprite = 0;
-	uint* backup = 0;
-	int2 lastPos;
-	Surface* lastTarget = 0;
+	uint* phases = 0; // optional pre-shifted frames, see BakePhases
+	int phaseBits = 0;
+	struct Span { short first, last; }; // [first, last)
+	vector<Span> spans;		// per frame and row pair, see BuildSpans
+	vector<int> spanStart;	// first span of frame f, row v at f * (frameSize - 1) + v
+	static inline bool simd = true; // Draw uses SSE4.1 or AVX2 if the CPU supports it
+	enum Blitter { BLIT_AUTO, BLIT_SCALAR, BLIT_SSE41, BLIT_AVX2 };
+	static inline Blitter blitter = BLIT_AUTO; // other values force a path; check CPUCaps first
+private:
+	void BuildSpans();
 };
 
 } // namespace Tmpl8
\ No newline at end of file
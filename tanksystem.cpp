@@ -0,0 +1,367 @@
+#include "precomp.h"
+
+#define SIMD_STEERING // use the AVX2 steering kernel if the CPU supports it
+#define SIM_LOD // simulate tanks far from the view and from enemies at a lower rate
+
+// TankSystem::Add : spawn a tank, returns its index
+int TankSystem::Add( Sprite* s, int2 p, int2 t, int f, int a )
+{
+	// create the static array of directions if it doesn't exist yet
+	if (Actor::directions == 0)
+	{
+		Actor::directions = new float2[256];
+		for (int i = 0; i < 256; i++) Actor::directions[i] = make_float2( sinf( i * PI / 128 ), -cosf( i * PI / 128 ) );
+	}
+	// set position and destination
+	pos.push_back( make_float2( p ) );
+	target.push_back( make_float2( t ) );
+	flow.push_back( -1 ), unrouted++; // flow field assigned lazily, in Tick
+	// set intial orientation / sprite frame; 0: north; 64: east; 128: south; 192: east
+	frame.push_back( f );
+	dir.push_back( Actor::directions[f] );
+	// assign tank to the specified army
+	army.push_back( a );
+	coolDown.push_back( 0 );
+	age.push_back( 0 );
+	hitByBullet.push_back( 0 );
+	alive.push_back( 1 );
+	sprite.push_back( s );
+	return (int)pos.size() - 1;
+}
+
+// TankSystem::Tick : tank behaviour, for all tanks
+void TankSystem::Tick()
+{
+	const int count = Count();
+	// tanks with a new target get the flow field for it; built only if no tank has it yet
+	if (unrouted > 0)
+	{
+		for (int i = 0; i < count; i++) if (flow[i] < 0) flow[i] = MyApp::flowField.Acquire( target[i] );
+		unrouted = 0;
+	}
+	// bullet hits of the previous frame
+	for (int t : hits) hitByBullet[t] = 1;
+	hits.clear();
+	nextPos.resize( count ), nextDir.resize( count );
+	nextFrame.resize( count ), nextCoolDown.resize( count );
+	request.resize( count ), stepped.resize( count ), evade.resize( count );
+	Schedule();
+	// phase 1: decide and move; reads the frozen state, writes only slot i of the next state.
+	// full rate tanks are processed in blocks of 8, so the AVX2 steering kernel sees full lanes;
+	// all other tanks wait here, unless they are due below
+	Timer timer;
+	const bool simd = CPUCaps::HW_AVX2;
+#pragma omp parallel for schedule(static)
+	for (int b = 0; b < (count + 7) / 8; b++)
+	{
+		const int first = b * 8, last = min( count, first + 8 );
+		bool single = last - first == 8; // all 8 tanks advance by a single frame
+		for (int i = first; i < last; i++)
+		{
+			if (tier[i] == 0) Think( i );
+			single &= tier[i] == 0 && age[i] == 1;
+		}
+	#ifdef SIMD_STEERING
+		if (simd && single) Steer8( first ); else
+	#endif
+		for (int i = first; i < last; i++) if (tier[i] == 0) Steer( i, i + 1 );
+		for (int i = first; i < last; i++)
+		{
+			// a destroyed or waiting tank keeps its state
+			if (tier[i] == 0 && !hitByBullet[i]) { stepped[i] = (uchar)age[i]; continue; }
+			nextPos[i] = pos[i], nextDir[i] = dir[i], nextFrame[i] = frame[i], nextCoolDown[i] = coolDown[i];
+			request[i] = 0, stepped[i] = 0;
+			if (!hitByBullet[i]) continue;
+			MyApp::events.SpawnParticleExplosion( sprite[i], pos[i], frame[i] );
+			alive[i] = 0; // removed in Compact, so grid indices stay valid this frame
+		}
+	}
+	tierTime[0] = timer.elapsed() * 1000;
+	for (int t = 1; t < LOD_TIERS; t++)
+	{
+		timer.reset();
+		const int* list = due[t].data();
+	#pragma omp parallel for schedule(static)
+		for (int j = 0; j < (int)due[t].size(); j++)
+		{
+			const int i = list[j];
+			Think( i );
+			Steer( i, i + 1 );
+			stepped[i] = (uchar)age[i];
+		}
+		tierTime[t] = timer.elapsed() * 1000;
+	}
+	// phase 2: side effects that depend on tank order (firing, tracks), so the result does
+	// not depend on the thread count; spawns are queued in MyApp::events
+	for (int i = 0; i < count; i++)
+	{
+		age[i] -= stepped[i];
+		if (hitByBullet[i]) continue;
+		// only one tank can fire per frame: the first one that wants to
+		if ((request[i] & FIRE) && MyApp::coolDown > 4)
+		{
+			MyApp::events.SpawnBullet( make_int2( pos[i] + 20 * dir[i] ), frame[i], army[i] );
+			// reset cooldown timer so we don't do rapid fire
+			nextCoolDown[i] = 1;
+			MyApp::coolDown = 0;
+		}
+		else nextCoolDown[i] = coolDown[i] + 1;
+		if (request[i] & TRACKS) for (int s = 0; s < stepped[i]; s++)
+		{
+			// draw tank tracks, only when not turning; one pair for each frame simulated
+			float2 perp( -dir[i].y, dir[i].x );
+			float2 p = pos[i] + (0.5f * s) * dir[i];
+			float2 trackPos1 = p - 9 * dir[i] + 4.5f * perp;
+			float2 trackPos2 = p - 9 * dir[i] - 5.5f * perp;
+			MyApp::map.bitmap->BlendBilerp( trackPos1.x, trackPos1.y, 0, 12 );
+			MyApp::map.bitmap->BlendBilerp( trackPos2.x, trackPos2.y, 0, 12 );
+			Map::Touch( (int)min( trackPos1.x, trackPos2.x ), (int)min( trackPos1.y, trackPos2.y ),
+				(int)max( trackPos1.x, trackPos2.x ) + 1, (int)max( trackPos1.y, trackPos2.y ) + 1 );
+		}
+	}
+	// the next state becomes the current state
+	pos.swap( nextPos ), dir.swap( nextDir );
+	frame.swap( nextFrame ), coolDown.swap( nextCoolDown );
+}
+
+// TankSystem::Schedule : assign each tank a level of detail tier. Tanks near the view
+// or within combat range of an enemy run every frame; others run every 2 or 4 frames,
+// staggered by index, and then advance by all frames they skipped. A tank that moves
+// into view or near an enemy catches up in the very next tick.
+void TankSystem::Schedule()
+{
+	const int count = Count();
+	tier.resize( count );
+	for (int t = 0; t < LOD_TIERS; t++) due[t].clear(), tierCount[t] = 0;
+	ticks++;
+#ifdef SIM_LOD
+	// armies within combat range of each cell: mark the cells with tanks, then spread
+	// each mark over its neighbours; two cells covers the fire range of 230 pixels
+	const int2 mapSize = MyApp::map.MapSize();
+	const int cw = (mapSize.x >> 7) + 1, ch = (mapSize.y >> 7) + 1;
+	auto cellOf = [&]( float2 p ) { return clamp( (int)p.x >> 7, 0, cw - 1 ) + clamp( (int)p.y >> 7, 0, ch - 1 ) * cw; };
+	armiesIn.assign( cw * ch, 0 ), armiesNear.assign( cw * ch, 0 );
+	for (int i = 0; i < count; i++) armiesIn[cellOf( pos[i] )] |= 1u << army[i]; // Scenario::Load allows 32 armies
+	for (int y = 0; y < ch; y++) for (int x = 0; x < cw; x++) if (armiesIn[x + y * cw])
+	{
+		for (int v = max( 0, y - 2 ); v <= min( ch - 1, y + 2 ); v++)
+			for (int u = max( 0, x - 2 ); u <= min( cw - 1, x + 2 ); u++) armiesNear[u + v * cw] |= armiesIn[x + y * cw];
+	}
+	// distance to the visible part of the map, plus a margin for the sprite
+	const int4 view = MyApp::map.view;
+	const float x1 = view.x - 64.0f, y1 = view.y - 64.0f, x2 = view.z + 64.0f, y2 = view.w + 64.0f;
+	for (int i = 0; i < count; i++)
+	{
+		age[i]++;
+		const float d = max( max( x1 - pos[i].x, pos[i].x - x2 ), max( y1 - pos[i].y, pos[i].y - y2 ) );
+		const bool combat = (armiesNear[cellOf( pos[i] )] & ~(1u << army[i])) != 0;
+		const int t = (d <= 0 || combat || hitByBullet[i]) ? 0 : d < 256 ? 1 : 2;
+		tier[i] = (uchar)t, tierCount[t]++;
+		if (t > 0 && ((ticks + i) & ((1 << t) - 1)) == 0) due[t].push_back( i );
+	}
+#else
+	for (int i = 0; i < count; i++) age[i]++, tier[i] = 0;
+	tierCount[0] = count;
+#endif
+}
+
+// TankSystem::Think : fire check and evasion of a single tank; must not write shared state
+void TankSystem::Think( int i )
+{
+	request[i] = 0;
+	evade[i] = 0;
+	// a tank that was hit only explodes, see Tick
+	if (hitByBullet[i]) return;
+	// want to fire a bullet if cooled down and enemy is in range
+	if (coolDown[i] > 200 && MyApp::coolDown > 4)
+	{
+		// query the grid for an enemy within the view cone; stops at the first one
+		if (MyApp::grid.FindEnemyInCone( pos[i] + dir[i] * 200, 30, army[i], pos[i], dir[i], 0.8f ) >= 0)
+			request[i] |= FIRE;
+	}
+	// evade other tanks; the first one close ahead decides
+	float2 toRight = make_float2( -dir[i].y, dir[i].x );
+	MyApp::grid.VisitNearbyTanks( pos[i], 30, i, [&]( int, float2 otherPos )
+	{
+		float2 toActor = otherPos - pos[i];
+		float sqrDist = dot( toActor, toActor );
+		if (sqrDist < 400 && dot( toActor, dir[i] ) > 0.35f)
+		{
+			evade[i] = (400 - sqrDist) * 0.02f * dot( toActor, toRight ) > 0 ? 1.0f : -1.0f;
+			return false;
+		}
+		return true;
+	} );
+}
+
+// Steer and Steer8 must round identically, see Steer8
+PRECISE_FP_BEGIN
+
+// TankSystem::Steer : steering, heading and movement of tanks first .. last - 1, by age[i] frames
+void TankSystem::Steer( int first, int last )
+{
+	const float2* directions = Actor::directions;
+	const ForceField& mountains = MyApp::mountainForce;
+	const FlowField& flowField = MyApp::flowField;
+	for (int i = first; i < last; i++)
+	{
+		// accumulate forces for steering left or right
+		// 1. target attracts, along the path found by the flow field
+		float2 toTarget = flowField.Direction( flow[i], pos[i] );
+		float2 toRight = make_float2( -dir[i].y, dir[i].x );
+		float steer = 2 * dot( toRight, toTarget );
+		// 2. mountains repel; one lookup in the precomputed repulsion field
+		float2 probePos = pos[i] + 8 * dir[i];
+		steer += dot( toRight, mountains.Sample( probePos ) );
+		// 3. evade other tanks, see Think
+		steer -= evade[i];
+		// adjust heading and move; a tank that skipped frames applies the same decision
+		// once for each of them
+		float speed = 1.0f;
+		int f = frame[i], turn = 0;
+		if (steer < -0.2f) turn = 255 /* i.e. -1 */, speed = 0.35f;
+		else if (steer > 0.2f) turn = 1, speed = 0.35f;
+		else request[i] |= TRACKS;
+		float2 p = pos[i];
+		for (int s = 0; s < age[i]; s++)
+		{
+			f = (f + turn) & 255;
+			p = p + directions[f] * speed * 0.5f;
+		}
+		nextFrame[i] = f;
+		nextDir[i] = directions[f];
+		nextPos[i] = p;
+	}
+}
+
+// Load8, Store8 : 8 float2s from / to separate x and y vectors
+static TARGET_AVX2 void Load8( const float2* p, __m256& x, __m256& y )
+{
+	__m256 lo = _mm256_loadu_ps( &p->x ), hi = _mm256_loadu_ps( &p[4].x );
+	__m256 xs = _mm256_shuffle_ps( lo, hi, _MM_SHUFFLE( 2, 0, 2, 0 ) ); // lane order 0 1 4 5 2 3 6 7
+	__m256 ys = _mm256_shuffle_ps( lo, hi, _MM_SHUFFLE( 3, 1, 3, 1 ) );
+	x = _mm256_castpd_ps( _mm256_permute4x64_pd( _mm256_castps_pd( xs ), _MM_SHUFFLE( 3, 1, 2, 0 ) ) );
+	y = _mm256_castpd_ps( _mm256_permute4x64_pd( _mm256_castps_pd( ys ), _MM_SHUFFLE( 3, 1, 2, 0 ) ) );
+}
+static TARGET_AVX2 void Store8( float2* p, __m256 x, __m256 y )
+{
+	__m256 lo = _mm256_unpacklo_ps( x, y ), hi = _mm256_unpackhi_ps( x, y ); // 0 1 4 5, 2 3 6 7
+	_mm256_storeu_ps( &p->x, _mm256_permute2f128_ps( lo, hi, 0x20 ) );
+	_mm256_storeu_ps( &p[4].x, _mm256_permute2f128_ps( lo, hi, 0x31 ) );
+}
+
+// Bilerp8 : bilinear lookup in a float2 grid for 8 positions in cell units, clamped
+// like ForceField::Sample; also returns the top-left sample. 'base' offsets each lane.
+static TARGET_AVX2 void Bilerp8( const float2* grid, __m256i base, int width, int height, __m256 u, __m256 v,
+	__m256& x, __m256& y, __m256& cornerX, __m256& cornerY )
+{
+	u = _mm256_max_ps( _mm256_min_ps( u, _mm256_set1_ps( (float)(width - 1) ) ), _mm256_setzero_ps() );
+	v = _mm256_max_ps( _mm256_min_ps( v, _mm256_set1_ps( (float)(height - 1) ) ), _mm256_setzero_ps() );
+	__m256i iu = _mm256_min_epi32( _mm256_cvttps_epi32( u ), _mm256_set1_epi32( width - 2 ) );
+	__m256i iv = _mm256_min_epi32( _mm256_cvttps_epi32( v ), _mm256_set1_epi32( height - 2 ) );
+	__m256 fu = _mm256_sub_ps( u, _mm256_cvtepi32_ps( iu ) ), fv = _mm256_sub_ps( v, _mm256_cvtepi32_ps( iv ) );
+	__m256 one = _mm256_set1_ps( 1 ), gu = _mm256_sub_ps( one, fu ), gv = _mm256_sub_ps( one, fv );
+	__m256i idx = _mm256_add_epi32( base, _mm256_add_epi32( iu, _mm256_mullo_epi32( iv, _mm256_set1_epi32( width ) ) ) );
+	idx = _mm256_slli_epi32( idx, 1 ); // float2 to float index
+	__m256i idxBelow = _mm256_add_epi32( idx, _mm256_set1_epi32( width * 2 ) );
+	const float* field = &grid->x;
+	__m256 result[2], corner[2];
+	for (int c = 0; c < 2; c++) // x, then y
+	{
+		__m256i i0 = _mm256_add_epi32( idx, _mm256_set1_epi32( c ) ), i2 = _mm256_add_epi32( idxBelow, _mm256_set1_epi32( c ) );
+		__m256 f0 = _mm256_i32gather_ps( field, i0, 4 ), f1 = _mm256_i32gather_ps( field + 2, i0, 4 );
+		__m256 f2 = _mm256_i32gather_ps( field, i2, 4 ), f3 = _mm256_i32gather_ps( field + 2, i2, 4 );
+		__m256 top = _mm256_add_ps( _mm256_mul_ps( f0, gu ), _mm256_mul_ps( f1, fu ) );
+		__m256 bottom = _mm256_add_ps( _mm256_mul_ps( f2, gu ), _mm256_mul_ps( f3, fu ) );
+		result[c] = _mm256_add_ps( _mm256_mul_ps( top, gv ), _mm256_mul_ps( bottom, fv ) );
+		corner[c] = f0;
+	}
+	x = result[0], y = result[1], cornerX = corner[0], cornerY = corner[1];
+}
+
+// TankSystem::Steer8 : AVX2 version of Steer for tanks first .. first + 7, which all
+// advance by one frame; same operations in the same order (no FMA), so the results
+// are bit-identical, as long as the compiler does not contract or reorder Steer or
+// the lookups it calls; those are compiled between PRECISE_FP_BEGIN and _END
+TARGET_AVX2 void TankSystem::Steer8( int first )
+{
+	const ForceField& mountains = MyApp::mountainForce;
+	const FlowField& flowField = MyApp::flowField;
+	__m256 px, py, dx, dy;
+	Load8( &pos[first], px, py );
+	Load8( &dir[first], dx, dy );
+	// 1. target attracts, along the path found by the flow field; as in FlowField::Direction
+	const __m256 invFlowCell = _mm256_set1_ps( flowField.invCellSize ), half = _mm256_set1_ps( 0.5f );
+	__m256i fieldBase = _mm256_mullo_epi32( _mm256_loadu_si256( (const __m256i*)&flow[first] ), _mm256_set1_epi32( flowField.width * flowField.height ) );
+	__m256 vx, vy, cornerX, cornerY;
+	Bilerp8( flowField.dir.data(), fieldBase, flowField.width, flowField.height, _mm256_sub_ps( _mm256_mul_ps( px, invFlowCell ), half ),
+		_mm256_sub_ps( _mm256_mul_ps( py, invFlowCell ), half ), vx, vy, cornerX, cornerY );
+	__m256 sqrLen = _mm256_add_ps( _mm256_mul_ps( vx, vx ), _mm256_mul_ps( vy, vy ) );
+	__m256 invLen = _mm256_div_ps( _mm256_set1_ps( 1 ), _mm256_sqrt_ps( sqrLen ) );
+	__m256 valid = _mm256_cmp_ps( sqrLen, _mm256_setzero_ps(), _CMP_GT_OQ );
+	vx = _mm256_blendv_ps( cornerX, _mm256_mul_ps( vx, invLen ), valid );
+	vy = _mm256_blendv_ps( cornerY, _mm256_mul_ps( vy, invLen ), valid );
+	__m256 rx = _mm256_sub_ps( _mm256_setzero_ps(), dy ), ry = dx;
+	__m256 steer = _mm256_mul_ps( _mm256_set1_ps( 2 ), _mm256_add_ps( _mm256_mul_ps( rx, vx ), _mm256_mul_ps( ry, vy ) ) );
+	// 2. mountains repel; bilinear lookup, as in ForceField::Sample
+	__m256 probeX = _mm256_add_ps( px, _mm256_mul_ps( _mm256_set1_ps( 8 ), dx ) );
+	__m256 probeY = _mm256_add_ps( py, _mm256_mul_ps( _mm256_set1_ps( 8 ), dy ) );
+	const __m256 offset = _mm256_set1_ps( mountains.margin - 0.5f ), invCell = _mm256_set1_ps( mountains.invCellSize );
+	__m256 force[2], unused[2];
+	Bilerp8( mountains.force, _mm256_setzero_si256(), mountains.width, mountains.height, _mm256_add_ps( _mm256_mul_ps( probeX, invCell ), offset ),
+		_mm256_add_ps( _mm256_mul_ps( probeY, invCell ), offset ), force[0], force[1], unused[0], unused[1] );
+	steer = _mm256_add_ps( steer, _mm256_add_ps( _mm256_mul_ps( rx, force[0] ), _mm256_mul_ps( ry, force[1] ) ) );
+	// 3. evade other tanks, see Think
+	steer = _mm256_sub_ps( steer, _mm256_loadu_ps( &evade[first] ) );
+	// adjust heading and move
+	__m256 left = _mm256_cmp_ps( steer, _mm256_set1_ps( -0.2f ), _CMP_LT_OQ );
+	__m256 right = _mm256_andnot_ps( left, _mm256_cmp_ps( steer, _mm256_set1_ps( 0.2f ), _CMP_GT_OQ ) );
+	__m256 turning = _mm256_or_ps( left, right );
+	__m256i f = _mm256_loadu_si256( (const __m256i*)&frame[first] );
+	f = _mm256_add_epi32( f, _mm256_and_si256( _mm256_castps_si256( left ), _mm256_set1_epi32( 255 ) ) );
+	f = _mm256_sub_epi32( f, _mm256_castps_si256( right ) ); // mask is -1
+	f = _mm256_and_si256( f, _mm256_set1_epi32( 255 ) );
+	_mm256_storeu_si256( (__m256i*)&nextFrame[first], f );
+	const float* directions = &Actor::directions->x;
+	__m256i f2 = _mm256_slli_epi32( f, 1 );
+	__m256 ndx = _mm256_i32gather_ps( directions, f2, 4 ), ndy = _mm256_i32gather_ps( directions + 1, f2, 4 );
+	Store8( &nextDir[first], ndx, ndy );
+	__m256 speed = _mm256_blendv_ps( _mm256_set1_ps( 1 ), _mm256_set1_ps( 0.35f ), turning );
+	Store8( &nextPos[first], _mm256_add_ps( px, _mm256_mul_ps( _mm256_mul_ps( ndx, speed ), half ) ),
+		_mm256_add_ps( py, _mm256_mul_ps( _mm256_mul_ps( ndy, speed ), half ) ) );
+	// draw tank tracks, only when not turning
+	int tracks = ~_mm256_movemask_ps( turning );
+	for (int i = 0; i < 8; i++) if (tracks & (1 << i)) request[first + i] |= TRACKS;
+}
+
+PRECISE_FP_END
+
+// TankSystem::Compact : delete destroyed tanks, replacing each by the last in the list
+void TankSystem::Compact()
+{
+	for (int i = 0; i < Count(); i++) if (!alive[i])
+	{
+		const int last = Count() - 1;
+		MyApp::grid.Remove( i, last );
+		if (flow[i] >= 0) MyApp::flowField.Release( flow[i] );
+		for (int& h : hits) if (h == last) h = i; // hits only refer to live tanks
+		if (i != last)
+		{
+			pos[i] = pos[last], dir[i] = dir[last], target[i] = target[last], flow[i] = flow[last];
+			frame[i] = frame[last], army[i] = army[last], coolDown[i] = coolDown[last], age[i] = age[last];
+			hitByBullet[i] = hitByBullet[last], alive[i] = alive[last];
+			sprite[i] = sprite[last];
+		}
+		pos.pop_back(), dir.pop_back(), target.pop_back(), flow.pop_back();
+		frame.pop_back(), army.pop_back(), coolDown.pop_back(), age.pop_back();
+		hitByBullet.pop_back(), alive.pop_back();
+		sprite.pop_back();
+		i--;
+	}
+}
+
+// TankSystem::Draw : draw all tanks
+void TankSystem::Draw()
+{
+	for (int s = Count(), i = 0; i < s; i++) MyApp::compositor.DrawSprite( sprite[i], pos[i], frame[i] );
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+#pragma once
+
+namespace Tmpl8
+{
+
+// All tanks, stored as a structure of arrays. Tanks are not actors: they are
+// updated and drawn by plain loops over contiguous per-field arrays.
+// Tick runs in two phases: a parallel phase in which every tank reads only the
+// frozen state of the previous frame and writes its own next state, and a
+// serial phase that applies side effects (firing, tracks) in tank order. Spawned
+// bullets and explosions are queued in MyApp::events. The result is
+// bit-identical for any number of threads.
+// Tanks far from the view and from enemies are simulated at a lower rate (see
+// Schedule); when they are due, they catch up on all frames they skipped.
+class TankSystem
+{
+public:
+	TankSystem() = default;
+	int Add( Sprite* s, int2 p, int2 t, int f, int a );
+	int Count() const { return (int)pos.size(); }
+	void Tick();
+	void Compact();
+	void Draw();
+	enum { FIRE = 1, TRACKS = 2 }; // per-tank requests from the parallel phase
+	enum { LOD_TIERS = 3 }; // tier t updates once every 2^t frames
+	int tierCount[LOD_TIERS] = {};		// tanks per tier, last Tick
+	float tierTime[LOD_TIERS] = {};		// phase 1 time per tier in ms, last Tick
+	// per-tank data; index i in each array belongs to tank i
+	vector<float2> pos, dir, target;
+	vector<int> frame, army, coolDown;
+	vector<int> flow; // index of the tank's field in MyApp::flowField
+	vector<uchar> hitByBullet, alive;
+	vector<Sprite*> sprite;
+	vector<int> hits; // tanks hit by bullets since the last Tick, see Bullet::Collide
+private:
+	void Schedule();
+	void Think( int i );
+	void Steer( int first, int last );
+	void Steer8( int first );
+	// next state, written by the parallel phase and swapped in afterwards
+	vector<float2> nextPos, nextDir;
+	vector<int> nextFrame, nextCoolDown;
+	vector<uchar> request;
+	vector<uchar> stepped; // frames simulated this tick; 0 if the tank waits
+	// level of detail
+	vector<uchar> tier;
+	vector<int> age; // frames not simulated yet
+	vector<int> due[LOD_TIERS]; // tanks of the lower rate tiers updated this tick
+	vector<uint> armiesIn, armiesNear; // per 128x128 cell: bit per army in it / within combat range
+	int ticks = 0;
+	int unrouted = 0; // tanks waiting for a flow field
+	vector<float> evade; // -1, 0 or 1: steering away from the nearest tank ahead
+};
+
+} // namespace Tmpl8
\ No newline at end of file
@@ -15,9 +15,15 @@
 #include <string>
 #include <thread>
 #include <math.h>
+#include <string.h>
 #include <algorithm>
 #include <assert.h>
+#include <stdarg.h>
+#ifdef _WIN32
 #include <io.h>
+#else
+#include <sys/stat.h>
+#endif
 
 #include "lib/stb_image.h"
 
@@ -32,6 +38,7 @@
 // C++ practice but a simplification for template projects.
 using namespace std;
 
+#ifndef HEADLESS
 // windows
 #define NOMINMAX
 #ifndef WIN32_LEAN_AND_MEAN
@@ -52,6 +59,7 @@ using namespace std;
 #include <glad.h>
 #include <GLFW/glfw3.h>
 #include <GLFW/glfw3native.h>
+#endif
 
 // zlib
 #include "zlib.h"
@@ -143,6 +151,7 @@ struct ALIGN( 4 ) uchar4 { uchar x, y, z, w; };
 #define FATALERROR_IN( prefix, errstr, fmt, ... ) FatalError( prefix " returned error '%s' at %s:%d" fmt "\n", errstr, __FILE__, __LINE__, ##__VA_ARGS__ );
 #define FATALERROR_IN_CALL( stmt, error_parser, fmt, ... ) do { auto ret = ( stmt ); if ( ret ) FATALERROR_IN( #stmt, error_parser( ret ), fmt, ##__VA_ARGS__ ) } while ( 0 )
 
+#ifndef HEADLESS
 // OpenGL texture wrapper
 class GLTexture
 {
@@ -197,6 +206,8 @@ void CheckShader( GLuint shader, const char* vshader, const char* fshader );
 void CheckProgram( GLuint id, const char* vshader, const char* fshader );
 void DrawQuad();
 
+#endif
+
 // timer
 struct Timer
 {
@@ -214,6 +225,7 @@ struct Timer
 // swap
 template <class T> void Swap( T& x, T& y ) { T t; t = x, x = y, y = t; }
 
+#ifndef HEADLESS
 // Nils's jobmanager
 class Job
 {
@@ -257,6 +269,8 @@ protected:
 	JobThread* m_JobThreadList;
 };
 
+#endif
+
 // pixel operations
 inline uint ScaleColor( const uint c, const uint scale )
 {
@@ -746,8 +760,14 @@ public:
 	{
 		struct
 		{
+#ifdef _MSC_VER
 			union { __m128 bmin4; float bmin[4]; struct { float3 bmin3; }; };
 			union { __m128 bmax4; float bmax[4]; struct { float3 bmax3; }; };
+#else
+			// gcc does not allow members with constructors in anonymous aggregates
+			union { __m128 bmin4; float bmin[4]; };
+			union { __m128 bmax4; float bmax[4]; };
+#endif
 		};
 		__m128 bounds[2] = { _mm_set_ps( 1e34f, 1e34f, 1e34f, 0 ), _mm_set_ps( -1e34f, -1e34f, -1e34f, 0 ) };
 	};
@@ -1076,6 +1096,7 @@ public:
 	float w = 1, x = 0, y = 0, z = 0;
 };
 
+#ifndef HEADLESS
 // OpenCL buffer
 class Buffer
 {
@@ -1165,6 +1186,8 @@ public:
 	inline static bool candoInterop = false, clStarted = false;
 };
 
+#endif
+
 // global project settigs; shared with OpenCL
 #include "common.h"
 
@@ -1177,14 +1200,31 @@ public:
 #include <iostream>
 #include <bitset>
 #include <array>
+#ifdef _MSC_VER
 #include <intrin.h>
+#endif
 
 // instruction set detection
 #ifdef _WIN32
 #define cpuid(info, x) __cpuidex(info, x, 0)
 #else
 #include <cpuid.h>
-void cpuid( int info[4], int InfoType ) { __cpuid_count( InfoType, 0, info[0], info[1], info[2], info[3] ); }
+inline void cpuid( int info[4], int InfoType ) { __cpuid_count( InfoType, 0, info[0], info[1], info[2], info[3] ); }
+#endif
+// functions using instructions beyond the SSE4.1 baseline; call only after checking CPUCaps
+#ifdef _MSC_VER
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__(( target( "avx2" ) ))
+#endif
+// code between these must round as written, without contraction or reordering, also
+// under /fp:fast; the gcc build disables contraction for all code (-ffp-contract=off)
+#ifdef _MSC_VER
+#define PRECISE_FP_BEGIN __pragma( float_control( precise, on, push ) )
+#define PRECISE_FP_END __pragma( float_control( pop ) )
+#else
+#define PRECISE_FP_BEGIN
+#define PRECISE_FP_END
 #endif
 class CPUCaps // from https://github.com/Mysticial/FeatureDetector
 {
@@ -1296,11 +1336,19 @@ public:
 
 // Add your headers here; they will be able to use all previously defined classes and namespaces.
 // In your own .cpp files just add #include "precomp.h".
+#include "pool.h"
+#include "tiled.h"
 #include "map.h"
 #include "sprite.h"
+#include "compositor.h"
 #include "actor.h"
+#include "tanksystem.h"
+#include "forcefield.h"
+#include "flowfield.h"
 #include "grid.h"
 #include "flag.h"
+#include "scenario.h"
+#include "events.h"
 #include "myapp.h"
 
 // EOF
\ No newline at end of file
@@ -28,10 +28,12 @@ extern "C"
 }
 #endif
 
+#ifndef HEADLESS
 static GLFWwindow* window = 0;
 static bool hasFocus = true, running = true;
 static GLTexture* renderTarget = 0;
 static int scrwidth = 0, scrheight = 0;
+#endif
 static TheApp* app = 0;
 
 // static member data for instruction set support class
@@ -40,6 +42,7 @@ static const CPUCaps cpucaps;
 // find the app implementation
 TheApp* CreateApp();
 
+#ifndef HEADLESS
 // GLFW callbacks
 void InitRenderTarget(int w, int h)
 {
@@ -299,6 +302,86 @@ void main()
 	glfwTerminate();
 }
 
+#else
+
+// Headless entry point: no window, no console and no OpenGL context; the app renders
+// into an offscreen surface. Usage: tanks_headless [frames] (default: 2048).
+int main(int argc, char** argv)
+{
+	// tanks_headless --generate <tanks> <file> [seed] : write a scenario and exit
+	if (argc > 3 && strcmp(argv[1], "--generate") == 0)
+	{
+		Scenario s = Scenario::Generate(max(0, atoi(argv[2])), MyApp::map.MapSize(), argc > 4 ? (uint)atoi(argv[4]) : 0x12345678);
+		if (!s.Save(argv[3])) FatalError("Could not write scenario %s", argv[3]);
+		printf("%s: %i tanks in %i blocks\n", argv[3], s.TankCount(), (int)s.blocks.size());
+		return 0;
+	}
+	// tanks_headless --bench-map : compare the map renderers and exit
+	if (argc > 1 && strcmp(argv[1], "--bench-map") == 0)
+	{
+		Surface screen(SCRWIDTH, SCRHEIGHT);
+		MyApp::map.Benchmark(&screen);
+		return 0;
+	}
+	// tanks_headless --bench-sprites : compare the sprite blitters and exit
+	if (argc > 1 && strcmp(argv[1], "--bench-sprites") == 0)
+	{
+		Surface screen(SCRWIDTH, SCRHEIGHT);
+		Sprite::Benchmark(&screen, MyApp::map);
+		return 0;
+	}
+	// tanks_headless --bench-forces : build the force fields, measure their error and exit
+	if (argc > 1 && strcmp(argv[1], "--bench-forces") == 0)
+	{
+		MyApp::LoadPeaks();
+		ForceField::Benchmark(MyApp::map.MapSize(), MyApp::peaks);
+		return 0;
+	}
+	// tanks_headless --bench-tiled : compare linear and tiled map storage and exit
+	if (argc > 1 && strcmp(argv[1], "--bench-tiled") == 0)
+	{
+		Surface screen(SCRWIDTH, SCRHEIGHT);
+		TiledSurface::Benchmark(MyApp::map.bitmap, &screen);
+		return 0;
+	}
+	// tanks_headless [--grid <cell size> <levels>] [frames] [scenario]
+	if (argc > 3 && strcmp(argv[1], "--grid") == 0)
+	{
+		MyApp::grid.SetCellSize(atoi(argv[2]), atoi(argv[3]));
+		argc -= 3, argv += 3;
+	}
+	const int frames = argc > 1 ? max(1, atoi(argv[1])) : 2048;
+	if (argc > 2) MyApp::scenarioFile = argv[2];
+	Surface* screen = new Surface(SCRWIDTH, SCRHEIGHT);
+	app = CreateApp();
+	app->screen = screen;
+	app->Init();
+	// same warm-up and measurement as the windowed build
+	float deltaTime = 0;
+	static Timer timer;
+	float totalTickTime = 0;
+	size_t allocations = 0;
+	for (int frameNr = 0; frameNr < frames + 50; frameNr++)
+	{
+		deltaTime = min(500.0f, 1000.0f * timer.elapsed());
+		timer.reset();
+		app->Tick(deltaTime);
+		if (frameNr >= 50) totalTickTime += timer.elapsed();
+		if (frameNr == 49) allocations = HeapAllocations();
+	}
+	printf("average tick time: %.3fms over %i frames\n", totalTickTime * 1000 / frames, frames);
+	printf("heap allocations in measured frames: %zu\n", HeapAllocations() - allocations);
+	// checksum of the final frame, for comparing runs
+	uint hash = 2166136261u;
+	for (int i = 0; i < SCRWIDTH * SCRHEIGHT; i++) hash = (hash ^ screen->pixels[i]) * 16777619u;
+	printf("frame checksum: %08x\n", hash);
+	app->Shutdown();
+	return 0;
+}
+
+#endif
+
+#ifndef HEADLESS
 // Jobmanager implementation
 DWORD JobThreadProc(LPVOID lpParameter)
 {
@@ -677,6 +760,8 @@ void Shader::SetUInt(const char* name, const uint v)
 	CheckGL();
 }
 
+#endif
+
 // RNG - Marsaglia's xor32
 static uint seed = 0x12345678;
 uint RandomUInt()
@@ -890,6 +975,8 @@ void FatalError(const char* fmt, ...)
 	while (1) exit(0);
 }
 
+#ifndef HEADLESS
+
 // source file information
 static int sourceFiles = 0;
 static char* sourceFile[64]; // yup, ugly constant
@@ -1536,6 +1623,8 @@ void Kernel::Run(const size_t count, const size_t localSize, cl_event* eventToWa
 	CHECKCL(error = clEnqueueNDRangeKernel(queue, kernel, 1, 0, &count, localSize == 0 ? 0 : &localSize, eventToWaitFor ? 1 : 0, eventToWaitFor, eventToSet));
 }
 
+#endif
+
 // surface implementation
 // ----------------------------------------------------------------------------
 
@@ -1754,6 +1843,8 @@ void Surface::InitCharset()
 	for (i = 0; i < 50; i++) s_Transl[(unsigned char)c[i]] = i;
 }
 
+#ifndef HEADLESS
+
 /*
 
 	OpenGL loader generated by glad 0.1.35 on Fri Mar 18 11:02:23 2022.
@@ -2896,4 +2987,6 @@ int gladLoadGLLoader(GLADloadproc load) {
 	return GLVersion.major != 0 || GLVersion.minor != 0;
 }
 
+#endif
+
 // EOF
\ No newline at end of file
@@ -0,0 +1,224 @@
+#include "precomp.h"
+
+// Morton : interleave the bits of x and y, x in the even bits
+static uint Morton( uint x, uint y )
+{
+	uint code = 0;
+	for (int i = 0; i < 16; i++) code |= ((x >> i) & 1) << (2 * i) | ((y >> i) & 1) << (2 * i + 1);
+	return code;
+}
+
+// TiledSurface::TiledSurface : tiled copy of a linear surface; the tiles on the right
+// and bottom edges are padded with black
+TiledSurface::TiledSurface( const Surface& src ) : width( src.width ), height( src.height )
+{
+	tilesX = (width + TILE - 1) / TILE, tilesY = (height + TILE - 1) / TILE;
+	// tile order: sort the tiles by Morton code, which skips the codes of the tiles
+	// that a power of two square would have outside the surface
+	vector<uint2> order; // (code, tile)
+	for (int y = 0; y < tilesY; y++) for (int x = 0; x < tilesX; x++) order.push_back( make_uint2( Morton( x, y ), x + y * tilesX ) );
+	sort( order.begin(), order.end(), []( const uint2& a, const uint2& b ) { return a.x < b.x; } );
+	tileStart.resize( order.size() );
+	for (int i = 0; i < (int)order.size(); i++) tileStart[order[i].y] = i * TILE * TILE;
+	// page aligned, so that a tile is exactly one page
+	const size_t bytes = order.size() * TILE * TILE * sizeof( uint );
+#ifdef _MSC_VER
+	pixels = (uint*)_aligned_malloc( bytes, 4096 );
+#else
+	pixels = (uint*)aligned_alloc( 4096, bytes );
+#endif
+	memset( pixels, 0, bytes );
+	for (int y = 0; y < height; y++) for (int x = 0; x < width; x += TILE)
+		memcpy( pixels + Index( x, y ), src.pixels + x + y * width, min( (int)TILE, width - x ) * sizeof( uint ) );
+}
+
+TiledSurface::~TiledSurface()
+{
+	FREE64( pixels ); // _aligned_free or free, matching the allocation
+}
+
+// TiledSurface::CopyTo : write the pixels to a linear surface of the same size
+void TiledSurface::CopyTo( Surface& dst ) const
+{
+	for (int y = 0; y < height; y++) for (int x = 0; x < width; x += TILE)
+		memcpy( dst.pixels + x + y * width, pixels + Index( x, y ), min( (int)TILE, width - x ) * sizeof( uint ) );
+}
+
+void TiledSurface::Plot( int x, int y, uint c )
+{
+	if (x < 0 || y < 0 || x >= width || y >= height) return;
+	pixels[Index( x, y )] = c;
+}
+
+void TiledSurface::Blend( int x, int y, uint c, uint w )
+{
+	if (x < 0 || y < 0 || x >= width || y >= height) return;
+	uint& p = pixels[Index( x, y )];
+	p = ScaleColor( c, w ) + ScaleColor( p, 255 - w );
+}
+
+// TiledSurface::BlendBilerp : as Surface::BlendBilerp; the four pixels share a tile
+// unless the position is on the last row or column of one
+void TiledSurface::BlendBilerp( float x, float y, uint c, uint w )
+{
+	int2 intPos = make_int2( (int)x, (int)y );
+	float frac_x = x - intPos.x;
+	float frac_y = y - intPos.y;
+	int w1 = (int)(256 * ((1 - frac_x) * (1 - frac_y)));
+	int w2 = (int)(256 * (frac_x * (1 - frac_y)));
+	int w3 = (int)(256 * ((1 - frac_x) * frac_y));
+	int w4 = (int)(256 * (frac_x * frac_y));
+	const int lx = intPos.x & (TILE - 1), ly = intPos.y & (TILE - 1);
+	if (intPos.x < 0 || intPos.y < 0 || intPos.x + 1 >= width || intPos.y + 1 >= height || lx == TILE - 1 || ly == TILE - 1)
+	{
+		// clipped or straddling tiles: per pixel
+		Blend( intPos.x, intPos.y, c, (w1 * w) >> 8 );
+		Blend( intPos.x + 1, intPos.y, c, (w2 * w) >> 8 );
+		Blend( intPos.x, intPos.y + 1, c, (w3 * w) >> 8 );
+		Blend( intPos.x + 1, intPos.y + 1, c, (w4 * w) >> 8 );
+		return;
+	}
+	uint* p = pixels + Index( intPos.x, intPos.y );
+	const uint ws[4] = { (uint)(w1 * w) >> 8, (uint)(w2 * w) >> 8, (uint)(w3 * w) >> 8, (uint)(w4 * w) >> 8 };
+	const int offset[4] = { 0, 1, TILE, TILE + 1 };
+	for (int i = 0; i < 4; i++) p[offset[i]] = ScaleColor( c, ws[i] ) + ScaleColor( p[offset[i]], 255 - ws[i] );
+}
+
+uint TiledSurface::Read( int x, int y )
+{
+	if (x < 0 || y < 0 || x >= width || y >= height) return 0;
+	return pixels[Index( x, y )];
+}
+
+// TiledSurface::Resample : bilinear resampling of a map area to a target, with the
+// same fixed point math as Map::Draw at mip level 0. Per screen row the two map rows
+// are fixed; the tile pointers change only when the taps move to the next tile.
+void TiledSurface::Resample( Surface* target, int4 view ) const
+{
+	const int dx = ((view.z - view.x) * 16384) / target->width;
+	const int dy = ((view.w - view.y) * 16384) / target->height;
+#pragma omp parallel for schedule(static)
+	for (int y = 0; y < target->height; y++)
+	{
+		const uint y_fp = (view.y << 14) + y * dy, y_frac = y_fp & 16383;
+		const int my = y_fp >> 14, tr0 = my >> TILE_BITS, tr1 = min( tilesY - 1, (my + 1) >> TILE_BITS );
+		const int r0 = (my & (TILE - 1)) << TILE_BITS, r1 = ((my + 1) & (TILE - 1)) << TILE_BITS;
+		const uint* a0 = 0, * a1 = 0, * b0 = 0, * b1 = 0; // rows 0 and 1 of this and the next tile
+		int tile = -1;
+		uint x_fp = view.x << 14;
+		uint* dst = target->pixels + y * target->width;
+		for (int x = 0; x < target->width; x++, x_fp += dx)
+		{
+			const int mx = x_fp >> 14, lx = mx & (TILE - 1);
+			if ((mx >> TILE_BITS) != tile)
+			{
+				tile = mx >> TILE_BITS;
+				const int next = min( tilesX - 1, tile + 1 );
+				a0 = pixels + tileStart[tr0 * tilesX + tile] + r0, b0 = pixels + tileStart[tr0 * tilesX + next] + r0;
+				a1 = pixels + tileStart[tr1 * tilesX + tile] + r1, b1 = pixels + tileStart[tr1 * tilesX + next] + r1;
+			}
+			const uint p1 = a0[lx], p3 = a1[lx];
+			const uint p2 = lx < TILE - 1 ? a0[lx + 1] : b0[0];
+			const uint p4 = lx < TILE - 1 ? a1[lx + 1] : b1[0];
+			const uint x_frac = x_fp & 16383;
+			const uint w1 = ((16383 - x_frac) * (16383 - y_frac)) >> 20;
+			const uint w3 = ((16383 - x_frac) * y_frac) >> 20;
+			const uint w2 = (x_frac * (16383 - y_frac)) >> 20;
+			const uint w4 = 255 - (w1 + w2 + w3);
+			dst[x] = ScaleColor( p1, w1 ) + ScaleColor( p2, w2 ) + ScaleColor( p3, w3 ) + ScaleColor( p4, w4 );
+		}
+	}
+}
+
+// ResampleLinear : the linear counterpart of TiledSurface::Resample
+static void ResampleLinear( const Surface& src, Surface* target, int4 view )
+{
+	const int dx = ((view.z - view.x) * 16384) / target->width;
+	const int dy = ((view.w - view.y) * 16384) / target->height;
+#pragma omp parallel for schedule(static)
+	for (int y = 0; y < target->height; y++)
+	{
+		const uint y_fp = (view.y << 14) + y * dy, y_frac = y_fp & 16383;
+		const uint* mapLine = src.pixels + (y_fp >> 14) * src.width;
+		uint x_fp = view.x << 14;
+		uint* dst = target->pixels + y * target->width;
+		for (int x = 0; x < target->width; x++, x_fp += dx)
+		{
+			const uint mapPos = x_fp >> 14;
+			const uint p1 = mapLine[mapPos], p2 = mapLine[mapPos + 1];
+			const uint p3 = mapLine[mapPos + src.width], p4 = mapLine[mapPos + src.width + 1];
+			const uint x_frac = x_fp & 16383;
+			const uint w1 = ((16383 - x_frac) * (16383 - y_frac)) >> 20;
+			const uint w3 = ((16383 - x_frac) * y_frac) >> 20;
+			const uint w2 = (x_frac * (16383 - y_frac)) >> 20;
+			const uint w4 = 255 - (w1 + w2 + w3);
+			dst[x] = ScaleColor( p1, w1 ) + ScaleColor( p2, w2 ) + ScaleColor( p3, w3 ) + ScaleColor( p4, w4 );
+		}
+	}
+}
+
+// TiledSurface::Benchmark : run the map access patterns of the game on a linear and a
+// tiled copy of a surface, and check that both produce the same pixels
+void TiledSurface::Benchmark( Surface* linear, Surface* target )
+{
+	Surface copy( linear->width, linear->height ), result( linear->width, linear->height );
+	memcpy( copy.pixels, linear->pixels, linear->width * linear->height * sizeof( uint ) );
+	TiledSurface tiled( *linear );
+	// sprite footprints: 36x36 blocks at random positions, read for the backup and
+	// blended; bilinear track marks of tanks that move a little per step
+	enum { SPRITES = 20000, BOX = 36, TRACKS = 8192, STEPS = 32 };
+	vector<int2> boxes( SPRITES );
+	for (int2& b : boxes) b = make_int2( RandomUInt() % linear->width, RandomUInt() % linear->height );
+	vector<float2> tracks( TRACKS ), dirs( TRACKS );
+	for (int i = 0; i < TRACKS; i++)
+	{
+		tracks[i] = make_float2( RandomFloat() * (linear->width - 1), RandomFloat() * (linear->height - 1) );
+		dirs[i] = make_float2( RandomFloat() - 0.5f, RandomFloat() - 0.5f );
+	}
+	printf( "map layout, ms per run       linear   tiled    same result\n" );
+	float time[2];
+	uint sum[2];
+	// sprite footprints
+	for (int layout = 0; layout < 2; layout++)
+	{
+		Timer timer;
+		sum[layout] = 0;
+		for (const int2& b : boxes) for (int y = b.y; y < b.y + BOX; y++) for (int x = b.x; x < b.x + BOX; x++)
+		{
+			sum[layout] += layout ? tiled.Read( x, y ) : copy.Read( x, y );
+			if (layout) tiled.Blend( x, y, 0x806040, 96 ); else copy.Blend( x, y, 0x806040, 96 );
+		}
+		time[layout] = timer.elapsed() * 1000;
+	}
+	tiled.CopyTo( result );
+	bool same = sum[0] == sum[1] && memcmp( copy.pixels, result.pixels, linear->width * linear->height * sizeof( uint ) ) == 0;
+	printf( "sprite read + blend       %8.2f %8.2f    %s\n", time[0], time[1], same ? "yes" : "NO" );
+	// track marks
+	for (int layout = 0; layout < 2; layout++)
+	{
+		Timer timer;
+		for (int s = 0; s < STEPS; s++) for (int i = 0; i < TRACKS; i++)
+		{
+			const float2 p = tracks[i] + dirs[i] * (float)s;
+			if (layout) tiled.BlendBilerp( p.x, p.y, 0x302010, 128 ); else copy.BlendBilerp( p.x, p.y, 0x302010, 128 );
+		}
+		time[layout] = timer.elapsed() * 1000;
+	}
+	tiled.CopyTo( result );
+	same = memcmp( copy.pixels, result.pixels, linear->width * linear->height * sizeof( uint ) ) == 0;
+	printf( "track BlendBilerp         %8.2f %8.2f    %s\n", time[0], time[1], same ? "yes" : "NO" );
+	// resampling the whole map, and a close-up as at zoom 20
+	Surface screen2( target->width, target->height );
+	const int4 views[2] = { make_int4( 0, 0, linear->width - 2, linear->height - 2 ), make_int4( 1600, 1000, 1600 + 819, 1000 + 461 ) };
+	for (int v = 0; v < 2; v++)
+	{
+		for (int layout = 0; layout < 2; layout++)
+		{
+			Timer timer;
+			for (int i = 0; i < 8; i++) if (layout) tiled.Resample( &screen2, views[v] ); else ResampleLinear( copy, target, views[v] );
+			time[layout] = timer.elapsed() * 1000 / 8;
+		}
+		same = memcmp( target->pixels, screen2.pixels, target->width * target->height * sizeof( uint ) ) == 0;
+		printf( "resample, %s      %8.2f %8.2f    %s\n", v ? "close-up  " : "whole map ", time[0], time[1], same ? "yes" : "NO" );
+	}
+}
\ No newline at end of file
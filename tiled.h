@@ -0,0 +1,39 @@
+#pragma once
+
+namespace Tmpl8
+{
+
+// A 32-bit surface stored as 32x32 pixel tiles, with pixels row-major within a
+// tile and the tiles in Morton (Z) order. A tile is one 4KB page, so a small 2D
+// neighbourhood, like a sprite footprint or the taps of a bilinear sample, touches
+// one to four pages, where a row-major map of 4096 pixels wide touches one per row.
+// Benchmark compares it with the linear layout on the access patterns of the game.
+// The map does not use it: since sprites draw on screen instead of into the map,
+// the remaining map accesses are resampling rows, which is slower tiled, and track
+// marks, which break even; Map::Draw and the mip chain also address rows directly.
+class TiledSurface
+{
+public:
+	enum { TILE_BITS = 5, TILE = 1 << TILE_BITS };
+	TiledSurface( const Surface& src );
+	~TiledSurface();
+	void CopyTo( Surface& dst ) const;
+	// offset of pixel (x, y) in pixels; (x, y) must be within the padded tiles
+	uint Index( int x, int y ) const
+	{
+		return tileStart[(y >> TILE_BITS) * tilesX + (x >> TILE_BITS)] + ((y & (TILE - 1)) << TILE_BITS) + (x & (TILE - 1));
+	}
+	// same behaviour as the Surface functions of the same name
+	void Plot( int x, int y, uint c );
+	void Blend( int x, int y, uint c, uint w );
+	void BlendBilerp( float x, float y, uint c, uint w );
+	uint Read( int x, int y );
+	void Resample( Surface* target, int4 view ) const;
+	static void Benchmark( Surface* linear, Surface* target );
+	uint* pixels = 0;
+	int width = 0, height = 0;
+	int tilesX = 0, tilesY = 0;
+	vector<uint> tileStart; // offset of each tile, row-major by tile position
+};
+
+} // namespace Tmpl8
\ No newline at end of file